@@ -14,6 +14,19 @@
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /*** defines ***/
 
@@ -22,6 +35,24 @@
 #define QUILLO_TAB_STOP 8
 #define QUILLO_MESSAGE_DURATION 5 //in seconds
 #define QUILLO_QUIT_TIMES 2 //how many times ctrl q has to be pressed before quitting without saving
+#define QUILLO_PERF_BUCKETS 96 //latency histogram buckets, 4 per power of two microseconds
+#define QUILLO_PERF_TRACE 4096 //how many frames are kept for the trace dump
+#define QUILLO_MAX_JOBS 8 //background jobs that can be scheduled at once
+#define QUILLO_JOB_SLICE_NS 1000000 //how long idle work runs before checking for input again
+#define QUILLO_PARALLEL_HL_ROWS 16384 //files at least this long get highlighted on every core
+#define QUILLO_MAX_HL_THREADS 16
+#define QUILLO_HLCACHE_UNUSED 65536 //unreferenced highlight cache entries kept around for reuse
+#define QUILLO_FOLLOW_CHUNK 65536 //bytes read at a time when ingesting appended data
+#define QUILLO_INDEX_VERSION 1 //bump whenever the line index sidecar layout changes
+#define QUILLO_PAGER_CHUNK (1<<20) //stream data is kept in chunks of this many bytes
+#define QUILLO_PAGER_ROWS_MAX ((size_t)1<<40) //address space reserved for row metadata under a memory cap
+#define QUILLO_PAGER_REFRESH_NS 50000000 //how often the screen follows a stream that is still coming in
+#define QUILLO_FILTER_CHUNK 65536 //bytes of filter input packed, and output read, at a time
+#define QUILLO_FILTER_SPLICE_MIN 16384 //shorter pieces of filter input are copied, longer ones spliced
+#define QUILLO_FILTER_PIPE (1<<20) //pipe size asked for, fewer round trips with the command
+#define QUILLO_FILTER_MAX_OUTPUT ((size_t)1<<30) //filter output is all held in memory until the command ends, past this it gets stopped
+#define QUILLO_FILTER_KILL_NS 2000000000 //how long a stopped filter command gets to exit before it is killed
+#define QUILLO_SYMBOL_RESULTS 64 //best matches the symbol prompt ranks and cycles through
 
 enum editorKeys {
     BACKSPACE = 127,
@@ -45,11 +76,28 @@ enum editorHighlight {
     HL_COMMENT,
     HL_MLCOMMENT,
     HL_KEYWORD1,
-    HL_KEYWORD2
+    HL_KEYWORD2,
+    HL_CLASSES //number of highlight classes, keep last
+};
+
+enum perfSpan {
+    PERF_SYNTAX = 0,
+    PERF_DRAW,
+    PERF_WRITE,
+    PERF_SPANS
+};
+
+enum symbolKind {
+    SYM_FUNCTION = 0,
+    SYM_STRUCT,
+    SYM_UNION,
+    SYM_ENUM,
+    SYM_TYPEDEF
 };
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HL_INDEX_SYMBOLS (1<<2) //definitions can be told apart with editorSymbolParse
 
 /*** data ***/
 
@@ -61,8 +109,57 @@ typedef struct erow{
     char *render;
     unsigned char *hl;
     int hlOpenComment;
+    struct hlEntry *hlShared; //cache entry hl belongs to, NULL if the row owns hl
+    int64_t offset; //where the line starts in the file, chars and render stay NULL until loaded from E.map
+    int eol; //bytes of line terminator after it, 2 for \r\n and 0 for a last line without one
+    int rcols; //screen columns render takes
+    int wraps; //screen lines it takes soft wrapped at E.wrapcols, 0 until counted
+    int ascii; //chars is plain ascii, so render bytes and columns line up
+    int brDelta; //bracket depth change across the row
+    int brMin; //lowest depth reached inside the row relative to its start, never above 0
+    int brKnown; //the two above match the current contents and highlight
+    struct symbol *sym; //what the row defines, NULL for nothing or while brKnown is not set
+    struct clipSpan *span; //owner of chars when they are borrowed from the clipboard, NULL if the row owns them
 } erow;
 
+//lines cut or copied, rows pasted from here borrow their chars until they are edited
+struct clipSpan{
+    int refs; //being the clipboard, plus every row or newer span line borrowing chars owned here
+    int nlines;
+    char **chars;
+    int *sizes;
+    struct clipSpan **owner; //span each line's chars belong to, this one or an older one
+    struct editorSyntax *syntax; //what the comment states were highlighted with
+    unsigned char *open; //comment state after each line, NULL when not all were highlighted yet
+    int *brDelta; //bracket counts of each line, there whenever open is
+    int *brMin;
+    struct symbol **sym; //definition on each line, one reference each
+};
+
+//how far the rows going into a filter command have got, a row's text goes out and then its newline
+struct filterInput{
+    int row; //where the piece after the current one starts
+    int newline;
+    int to; //first row not sent
+    char *p; //the current piece
+    size_t len;
+    size_t done; //bytes of it already in the pipe or the buffer
+    char buf[QUILLO_FILTER_CHUNK]; //short rows packed together
+    int buflen;
+    int sent;
+};
+
+//filter command output cut into lines as it comes in, each one later becomes the chars of a row
+struct filterOutput{
+    char **lines;
+    int *sizes;
+    int n;
+    int cap;
+    char *part; //a line still waiting for its newline
+    int partlen;
+    size_t bytes; //read so far
+};
+
 struct editorSyntax{
     char *filetype;
     char **filematch;
@@ -73,11 +170,203 @@ struct editorSyntax{
     int flags;
 };
 
+struct perfFrame{
+    uint64_t start; //monotonic time the frame finished, in ns
+    uint64_t latency; //keystroke to frame, 0 if the frame was not caused by a key
+    uint64_t span[PERF_SPANS];
+    int bytes; //bytes written to the terminal
+    int hlrows; //rows highlighted since the previous frame
+};
+
+struct editorPerf{
+    uint64_t keyTime; //when the last key was read, 0 once it has been drawn
+    uint64_t span[PERF_SPANS]; //time spent in each hot path during the current frame
+    int hlrows;
+    unsigned long hist[QUILLO_PERF_BUCKETS];
+    unsigned long samples;
+    struct perfFrame trace[QUILLO_PERF_TRACE]; //ring buffer of the latest frames
+    unsigned long frames;
+    int overlay; //show latency in the status bar
+    char *dumpfile; //where to write the histogram and trace on exit
+};
+
+//state of follow mode, tail -f style ingest of data appended to the open file
+struct editorFollow{
+    int fd; //the followed file, -1 when not following
+    int inotify;
+    int wd; //watch on the file
+    int dirwd; //watch on its directory, to see the file come back after rotation
+    char *name; //basename, to match directory events
+    off_t offset; //bytes of the file already ingested
+    int partial; //last row has not been terminated by a newline yet
+};
+
+//fenwick tree over a per row weight, answers prefix sums and which row a position falls in
+struct rowIndex{
+    int64_t (*weight)(erow *row);
+    int64_t *tree; //1 based
+    int n; //rows it covers
+    int cap;
+    int stale; //rows were added or removed since it was built
+    int from; //rows from here on were added, removed or moved, rows before it keep their nodes, INT_MAX when none were
+};
+
+//segment tree over the rows' bracket counts, a node has the depth change across its rows and the lowest depth inside them
+struct bracketNode{
+    int sum;
+    int min;
+};
+
+struct bracketIndex{
+    struct bracketNode *tree; //1 based, leaves from size on
+    int size; //power of two
+    int n; //rows it covers
+    int stale; //rows were added or removed since it was built
+    int pending; //rows from here on may not have been counted even before the highlight frontier
+};
+
+//one change in a batch of rows inserted and deleted, in row numbers from before the batch
+struct rowShift{
+    int at;
+    int delta; //rows inserted before at, or -delta rows deleted from at on
+    int before; //sum of the deltas of the changes before this one, see rowShiftPrepare
+};
+
+//a name some line defines, shared by every row and highlight cache entry with that line
+struct symbol{
+    int refs;
+    int kind;
+    int at; //render byte the name starts at
+    int len;
+    uint32_t mask; //letters, digits and _ in the name, lets a search skip names that cannot match
+    char name[];
+};
+
+//an entry stays small so a search going through all of them reads little, the symbol itself is the one on its row
+struct symbolRef{
+    int row;
+    uint32_t name; //where its search copy is in names
+    uint64_t key; //mask of the name, then the mask of characters starting a word, then the length up to 63, see symbolKey
+};
+
+//every definition in the buffer ordered by row, the gap sits where the last change went so a pass of the highlighter adds in order without moving the rest
+struct symbolIndex{
+    struct symbolRef *all;
+    int count; //entries, not counting the gap
+    int cap;
+    int gap; //entries from here on are kept at the end of all
+    char *names; //search copies of the names, see symbolNameSize
+    size_t nameBytes;
+    size_t nameCap;
+    size_t nameDead; //bytes no entry uses anymore, dropped once they are the majority
+    unsigned long version; //bumped on every change, tells a search whether its earlier matches still hold
+};
+
+//read only viewing of a pipe, the stream lives in chunks and older ones can be spilled to a temp file
+struct editorPager{
+    int active;
+    int fd; //the stream, -1 once it reached its end
+    char **chunks; //NULL for chunks that were spilled
+    int nchunks;
+    int firstResident; //chunks before this one only exist in the spill file
+    int64_t total; //bytes received so far
+    int64_t lineStart; //where the line still waiting for its newline begins
+    int cr; //last byte received was a \r
+    size_t cap; //stream bytes to keep in memory, 0 for no limit
+    int spill; //unlinked temp file, -1 until first needed
+    int rowfd; //with a cap the row array is a shared mapping of this temp file, -1 otherwise
+    int trimmed; //rows before this one were last dropped from memory
+    int pendingRefresh; //new data has not been drawn yet
+    uint64_t lastRefresh;
+};
+
+//a job does a small piece of work each step and returns 1 while there is more left
+typedef int (*editorJobStep)(uint64_t deadline);
+
+//a closed fold hides rows (start, end], its first row stays visible
+struct fold{
+    int start, end;
+};
+
+struct editorFolds{
+    struct fold *all; //every closed fold ordered by start, nested ones included
+    int count;
+    int cap;
+    struct fold *top; //the outermost ones, disjoint and ordered, these are what gets skipped
+    int ntop;
+};
+
+#define CURSOR_PRIMARY (1<<0) //stands for E.cx and E.cy while an edit runs
+#define CURSOR_JOIN (1<<1) //backspace at column 0, joins its row with the one above
+
+struct cursor{
+    int cx, cy;
+    int flags;
+};
+
+//cursors besides E.cx and E.cy, ordered by position
+struct editorCursors{
+    struct cursor *all;
+    int count;
+    int cap;
+    char *word; //what ctrl d looks for next
+    int lastcx, lastcy; //the last cursor ctrl d added, the next search starts after it
+};
+
+//text between a mark and the cursor
+struct editorSelection{
+    int active;
+    int cx, cy; //the mark
+};
+
+//everything that belongs to one open file, the live one is kept in E and the others here
+struct editorBuffer{
+    int cx, cy, rx;
+    int rowoffset, coloffset, wrapoffset;
+    struct rowIndex wrap;
+    int wrapcols;
+    struct rowIndex bytes;
+    struct bracketIndex brackets;
+    struct symbolIndex symbols;
+    int numrows;
+    int rowcap;
+    erow *row;
+    char *filename;
+    int dirty;
+    struct editorSyntax *syntax;
+    int hlFrontier;
+    struct editorFollow follow;
+    struct stat filestat;
+    int cacheable;
+    char *map;
+    size_t mapsize;
+    struct editorSyntax *hlStates;
+    struct editorPager pager;
+    int readonly;
+    int drawnFrom, drawnTo;
+    struct editorFolds folds;
+    struct editorCursors cursors;
+    struct editorSelection sel;
+};
+
 struct editorConfig {
     int cx, cy; //cursor position
     int screenrows, screencols; //screen size
     int rowoffset, coloffset; //scrolling
+    int softwrap; //wrap long rows instead of scrolling horizontally
+    int wrapoffset; //first visible screen line of the row at rowoffset when wrapping
+    struct rowIndex wrap; //screen lines every row takes when soft wrapped
+    int wrapcols; //screen width the wrap index was built for
+    struct rowIndex bytes; //bytes every row takes in the file, newline included
+    struct bracketIndex brackets; //finds matching brackets without scanning the rows in between
+    struct bracketPair{
+        int row0, at0; //opening bracket, render byte, both -1 when there is none
+        int row1, at1; //closing bracket
+    } pair; //brackets around the cursor, shown in the last frame
+    struct symbolIndex symbols; //definitions for the symbol prompt
+    volatile sig_atomic_t resized; //set by SIGWINCH
     int numrows;
+    int rowcap; //allocated rows, grows geometrically
     erow *row;    
     int rx; //index into render, for tabs
     char *filename;
@@ -86,10 +375,79 @@ struct editorConfig {
     int dirty; //has the file been modified
     struct termios org_termios;
     struct editorSyntax *syntax;
+    int hlFrontier; //rows before this one have up to date highlighting
+    editorJobStep jobs[QUILLO_MAX_JOBS]; //pending background work
+    int numjobs;
+    struct editorFollow follow;
+    char *cachedir; //where line index sidecars live, NULL to not use them
+    struct stat filestat; //of the file when it was opened, keys the sidecar
+    int cacheable; //rows still match the file on disk line for line
+    char *map; //the file mapped read only, backs rows that were never loaded
+    size_t mapsize;
+    struct editorSyntax *hlStates; //hlOpenComment of every row is already known for this syntax
+    struct editorPager pager;
+    int readonly;
+    int drawnFrom, drawnTo; //rows loaded by the last frame
+    struct editorFolds folds;
+    struct editorCursors cursors;
+    struct editorSelection sel;
+    struct clipSpan *clipboard; //shared by every buffer
+    struct editorBuffer *buffers; //every open buffer, the slot of the current one is out of date
+    int numbuffers;
+    int curbuffer;
+    struct editorPerf perf;
 };
 
 struct editorConfig E;
 
+//SGR sequence for every highlight class, built once by editorInitColors
+struct hlColorSeq{
+    int color;
+    int len;
+    char seq[8];
+} hlColors[HL_CLASSES];
+
+//highlight of a line keyed by its render text, entry comment state and syntax, shared by every row with that text
+struct hlEntry{
+    uint64_t hash;
+    struct editorSyntax *syntax;
+    int rsize;
+    int inComment;
+    int outComment;
+    int refs;
+    unsigned char *hl;
+    int brDelta, brMin; //bracket counts, they only depend on render and hl
+    struct symbol *sym; //what the line defines, one reference
+    struct hlEntry *next;
+    char render[]; //the text itself, a hit compares it so a hash collision cannot hand out another line's highlight
+};
+
+struct editorHlCache{
+    struct hlEntry **buckets;
+    int nbuckets; //power of two
+    int count;
+    int unused; //entries no row refers to anymore
+} hlCache;
+
+struct symbolMatch{
+    int score;
+    int row;
+    struct symbol *sym; //one reference, the highlight jobs keep running while the prompt is open
+};
+
+//what the symbol prompt found so far, kept between keys
+struct symbolSearch{
+    char prompt[80]; //rewritten after every key to show the current match
+    struct symbolMatch best[QUILLO_SYMBOL_RESULTS]; //ranked once the search is done
+    int nbest;
+    int worst; //the one to drop for a better match while searching
+    int current;
+    int *cand; //positions in the index of entries that may match, a longer query only looks at these
+    int ncand;
+    char *query; //lowercase, as last searched
+    unsigned long version; //of the index when cand was filled
+} symbolSearch;
+
 
 /*** filetypes ***/
 
@@ -114,7 +472,7 @@ struct editorSyntax HLDB[] = {
         C_HL_extensions,
         C_HL_keywords,
         "//", "/*", "*/",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_INDEX_SYMBOLS
     },
 };
 
@@ -122,9 +480,186 @@ struct editorSyntax HLDB[] = {
 
 /*** prototypes ***/
 
+void die(const char *s);
+void editorRowLoad(erow *row);
+void editorRowUnload(erow *row);
+int editorIndexLoad(int fd);
+void editorFollowEvents();
+void editorPagerRead();
+void editorBufferClose();
+int editorFoldAt(int filerow);
+void editorMoveCursor(int key);
+void editorPagerCopy(char *dst, int64_t offset, int len);
+void editorUpdateWindowSize();
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorBracketCount(char *render, unsigned char *hl, int len, int *delta, int *min);
+void bracketIndexUpdate(erow *row);
+void bracketIndexAppend();
+void bracketIndexRemoved(int at, int n);
+struct symbol *editorSymbolParse(char *render, unsigned char *hl, int len);
+void editorSymbolRelease(struct symbol *sym);
+void editorRowSetSymbol(erow *row, struct symbol *sym);
+void symbolIndexShift(int at, int delta);
+void symbolIndexRemap(const struct rowShift *s, int n);
+
+/*** profiling ***/
+
+uint64_t perfNow(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void perfAddSpan(int span, uint64_t start){
+    E.perf.span[span] += perfNow() - start;
+}
+
+//log scale bucket, 4 sub buckets for every power of two microseconds
+int perfBucket(uint64_t us){
+    if(us < 4) return (int)us;
+    int msb = 63 - __builtin_clzll(us);
+    int b = (msb-1)*4 + (int)((us >> (msb-2)) & 3);
+    return b < QUILLO_PERF_BUCKETS ? b : QUILLO_PERF_BUCKETS-1;
+}
+
+uint64_t perfBucketLow(int b){
+    if(b < 4) return b;
+    int msb = b/4 + 1;
+    return (uint64_t)(4 + b%4) << (msb-2);
+}
+
+uint64_t perfBucketHigh(int b){
+    if(b < 4) return b;
+    return perfBucketLow(b) + ((uint64_t)1 << (b/4 - 1)) - 1;
+}
+
+//upper bound in microseconds of the given percentile of keystroke latency
+uint64_t perfPercentile(int pct){
+    if(E.perf.samples == 0) return 0;
+    unsigned long target = (E.perf.samples * pct + 99) / 100;
+    unsigned long seen = 0;
+    for(int b=0;b<QUILLO_PERF_BUCKETS;b++){
+        seen += E.perf.hist[b];
+        if(seen >= target) return perfBucketHigh(b);
+    }
+    return perfBucketHigh(QUILLO_PERF_BUCKETS-1);
+}
+
+//called once the frame hit the terminal
+void perfEndFrame(int bytes){
+    uint64_t now = perfNow();
+    struct perfFrame *f = &E.perf.trace[E.perf.frames % QUILLO_PERF_TRACE];
+
+    f->start = now;
+    f->latency = E.perf.keyTime ? now - E.perf.keyTime : 0;
+    memcpy(f->span, E.perf.span, sizeof(f->span));
+    f->bytes = bytes;
+    f->hlrows = E.perf.hlrows;
+    E.perf.frames++;
+
+    if(E.perf.keyTime){
+        E.perf.hist[perfBucket(f->latency / 1000)]++;
+        E.perf.samples++;
+    }
+
+    E.perf.keyTime = 0;
+    E.perf.hlrows = 0;
+    memset(E.perf.span, 0, sizeof(E.perf.span));
+}
+
+void perfDump(){
+    if(E.perf.dumpfile == NULL) return;
+    FILE *fp = fopen(E.perf.dumpfile, "w");
+    if(!fp) return;
+
+    fprintf(fp, "# quillo %s latency histogram, %lu samples, p50 %lluus p99 %lluus\n", QUILLO_VERSION,
+        E.perf.samples, (unsigned long long)perfPercentile(50), (unsigned long long)perfPercentile(99));
+    fprintf(fp, "# low_us high_us count\n");
+    for(int b=0;b<QUILLO_PERF_BUCKETS;b++){
+        if(E.perf.hist[b] == 0) continue;
+        fprintf(fp, "%llu %llu %lu\n", (unsigned long long)perfBucketLow(b), (unsigned long long)perfBucketHigh(b), E.perf.hist[b]);
+    }
+
+    fprintf(fp, "\n# trace: time_ns latency_ns syntax_ns draw_ns write_ns bytes hlrows\n");
+    unsigned long first = E.perf.frames > QUILLO_PERF_TRACE ? E.perf.frames - QUILLO_PERF_TRACE : 0;
+    for(unsigned long i=first;i<E.perf.frames;i++){
+        struct perfFrame *f = &E.perf.trace[i % QUILLO_PERF_TRACE];
+        fprintf(fp, "%llu %llu %llu %llu %llu %d %d\n", (unsigned long long)f->start, (unsigned long long)f->latency,
+            (unsigned long long)f->span[PERF_SYNTAX], (unsigned long long)f->span[PERF_DRAW],
+            (unsigned long long)f->span[PERF_WRITE], f->bytes, f->hlrows);
+    }
+    fclose(fp);
+}
+
+/*** scheduler ***/
+
+void editorScheduleJob(editorJobStep step){
+    for(int j=0;j<E.numjobs;j++){
+        if(E.jobs[j] == step) return;
+    }
+    if(E.numjobs == QUILLO_MAX_JOBS) return;
+    E.jobs[E.numjobs++] = step;
+}
+
+//run pending jobs round robin for one time slice, dropping the ones that finish
+void editorRunJobs(){
+    uint64_t deadline = perfNow() + QUILLO_JOB_SLICE_NS;
+    int hlrows = E.perf.hlrows; //idle work is not charged to the next keystroke
+
+    int j = 0;
+    while(E.numjobs > 0 && perfNow() < deadline){
+        if(j >= E.numjobs) j = 0;
+        if(E.jobs[j](deadline)){
+            j++;
+            continue;
+        }
+        E.numjobs--;
+        memmove(&E.jobs[j], &E.jobs[j+1], sizeof(E.jobs[0]) * (E.numjobs - j));
+    }
+    E.perf.hlrows = hlrows;
+}
+
+//block until there is input, doing background work in slices while idle
+void editorWaitForInput(){
+    struct pollfd pfd[3] = {
+        { STDIN_FILENO, POLLIN, 0 },
+        { E.follow.inotify, POLLIN, 0 }, //negative fds are ignored by poll
+        { E.pager.fd, POLLIN, 0 }
+    };
+    while(1){
+        //a resize that came while jobs ran or the screen was drawn did not interrupt a poll
+        if(E.resized){
+            editorUpdateWindowSize();
+            editorRefreshScreen();
+        }
+        int timeout = E.pager.pendingRefresh ? QUILLO_PAGER_REFRESH_NS / 1000000 : -1;
+        int n = poll(pfd, 3, E.numjobs ? 0 : timeout);
+        if(n == -1){
+            if(errno != EINTR) die("poll");
+            continue;
+        }
+        if(pfd[0].revents) return;
+        if(pfd[1].revents){
+            editorFollowEvents();
+            editorRefreshScreen();
+            continue;
+        }
+        if(pfd[2].revents){
+            editorPagerRead();
+            pfd[2].fd = E.pager.fd;
+            E.pager.pendingRefresh = 1;
+        }
+        //a fast stream would otherwise redraw for every chunk
+        if(E.pager.pendingRefresh && (E.pager.fd == -1 || perfNow() - E.pager.lastRefresh >= QUILLO_PAGER_REFRESH_NS)){
+            editorRefreshScreen();
+            E.pager.lastRefresh = perfNow();
+            E.pager.pendingRefresh = 0;
+        }
+        if(n == 0 || pfd[2].revents == 0) editorRunJobs();
+    }
+}
 
 /*** terminal ***/
 
@@ -163,12 +698,15 @@ void enableRawMode(){
 int editorReadKey(){
     int nread;
     char c;
+    editorWaitForInput();
     while((nread = read(STDIN_FILENO, &c, 1)) != 1){
         if(
             nread == -1 //read failure
             && errno != EAGAIN //not a timeout (Cygwin)
         ) die("read");
     }
+    if(!E.perf.keyTime) E.perf.keyTime = perfNow();
+
     if(c != '\x1b'){
         return c;
     }
@@ -249,10 +787,277 @@ int getWindowSize(int *rows, int *cols){
     }
 }
 
+/*** highlight cache ***/
+
+uint64_t editorHashRender(const char *s, int len){
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (uint64_t)len;
+    uint64_t k;
+    while(len >= 8){
+        memcpy(&k, s, 8);
+        h = (h ^ (k * 0xbf58476d1ce4e5b9ull)) * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        s += 8;
+        len -= 8;
+    }
+    k = 0;
+    memcpy(&k, s, len);
+    h = (h ^ (k * 0xbf58476d1ce4e5b9ull)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 29);
+}
+
+void editorHlCacheSweep(){
+    for(int b=0;b<hlCache.nbuckets;b++){
+        struct hlEntry **p = &hlCache.buckets[b];
+        while(*p){
+            struct hlEntry *e = *p;
+            if(e->refs){
+                p = &e->next;
+                continue;
+            }
+            *p = e->next;
+            free(e->hl);
+            editorSymbolRelease(e->sym);
+            free(e);
+            hlCache.count--;
+        }
+    }
+    hlCache.unused = 0;
+}
+
+void editorHlCacheGrow(){
+    int nbuckets = hlCache.nbuckets ? hlCache.nbuckets * 2 : 1024;
+    struct hlEntry **buckets = calloc(nbuckets, sizeof(*buckets));
+    for(int b=0;b<hlCache.nbuckets;b++){
+        struct hlEntry *e = hlCache.buckets[b];
+        while(e){
+            struct hlEntry *next = e->next;
+            e->next = buckets[e->hash & (nbuckets-1)];
+            buckets[e->hash & (nbuckets-1)] = e;
+            e = next;
+        }
+    }
+    free(hlCache.buckets);
+    hlCache.buckets = buckets;
+    hlCache.nbuckets = nbuckets;
+}
+
+struct hlEntry *editorHlCacheFind(uint64_t hash, erow *row, int inComment){
+    if(hlCache.nbuckets == 0) return NULL;
+    struct hlEntry *e = hlCache.buckets[hash & (hlCache.nbuckets-1)];
+    for(;e;e=e->next){
+        if(e->hash == hash && e->rsize == row->rsize && e->inComment == inComment && e->syntax == E.syntax
+            && !memcmp(e->render, row->render, row->rsize)) return e;
+    }
+    return NULL;
+}
+
+//takes ownership of hl
+struct hlEntry *editorHlCacheAdd(uint64_t hash, erow *row, int inComment, int outComment, unsigned char *hl){
+    if(hlCache.unused > QUILLO_HLCACHE_UNUSED) editorHlCacheSweep();
+    if(hlCache.count >= hlCache.nbuckets) editorHlCacheGrow();
+
+    struct hlEntry *e = malloc(sizeof(*e) + row->rsize);
+    memcpy(e->render, row->render, row->rsize);
+    e->hash = hash;
+    e->syntax = E.syntax;
+    e->rsize = row->rsize;
+    e->inComment = inComment;
+    e->outComment = outComment;
+    e->refs = 0;
+    e->hl = hl;
+    editorBracketCount(row->render, hl, row->rsize, &e->brDelta, &e->brMin);
+    e->sym = (E.syntax && (E.syntax->flags & HL_INDEX_SYMBOLS)) ? editorSymbolParse(row->render, hl, row->rsize) : NULL;
+    e->next = hlCache.buckets[hash & (hlCache.nbuckets-1)];
+    hlCache.buckets[hash & (hlCache.nbuckets-1)] = e;
+    hlCache.count++;
+    hlCache.unused++;
+    return e;
+}
+
+void editorRowReleaseHl(erow *row){
+    if(row->hlShared){
+        if(--row->hlShared->refs == 0) hlCache.unused++;
+    } else {
+        free(row->hl);
+    }
+    row->hl = NULL;
+    row->hlShared = NULL;
+}
+
+void editorRowShareHl(erow *row, struct hlEntry *e){
+    editorRowReleaseHl(row);
+    if(e->refs++ == 0) hlCache.unused--;
+    row->hl = e->hl;
+    row->hlShared = e;
+    if(!row->brKnown || row->brDelta != e->brDelta || row->brMin != e->brMin){
+        row->brDelta = e->brDelta;
+        row->brMin = e->brMin;
+        row->brKnown = 1;
+        bracketIndexUpdate(row);
+    }
+    editorRowSetSymbol(row, e->sym);
+}
+
+//give the row a private copy of hl before writing into it
+void editorRowOwnHl(erow *row){
+    if(row->hlShared == NULL) return;
+    unsigned char *hl = malloc(row->rsize);
+    memcpy(hl, row->hl, row->rsize);
+    editorRowReleaseHl(row);
+    row->hl = hl;
+}
+
+//move the row's private hl into the cache, or drop it for an equal cached one
+void editorRowInternHl(erow *row, int inComment){
+    if(row->hlShared) return;
+    uint64_t hash = editorHashRender(row->render, row->rsize);
+    struct hlEntry *e = editorHlCacheFind(hash, row, inComment);
+    if(e == NULL){
+        e = editorHlCacheAdd(hash, row, inComment, row->hlOpenComment, row->hl);
+    } else {
+        free(row->hl);
+    }
+    row->hl = NULL;
+    editorRowShareHl(row, e);
+}
+
+/*** terminal size ***/
+
+void editorUpdateWindowSize(){
+    E.resized = 0;
+    if(getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
+    E.screenrows -= 2;
+}
+
+void editorHandleWinch(int sig){
+    (void)sig;
+    E.resized = 1;
+}
+
+/*** utf-8 ***/
+
+/*
+render keeps utf-8 as is, rx, coloffset and the wrap index count screen columns
+rows that are pure ascii, the usual case, skip decoding entirely
+*/
+
+struct widthRange{
+    int lo, hi;
+    int width;
+};
+
+//zero width and double width code points, everything else not listed takes one column
+struct widthRange widthTable[] = {
+    {0x0300, 0x036f, 0}, {0x0483, 0x0489, 0}, {0x0591, 0x05bd, 0}, {0x0610, 0x061a, 0}, {0x064b, 0x065f, 0},
+    {0x0e31, 0x0e31, 0}, {0x0e34, 0x0e3a, 0}, {0x0e47, 0x0e4e, 0}, {0x1100, 0x115f, 2}, {0x1ab0, 0x1aff, 0},
+    {0x1dc0, 0x1dff, 0}, {0x200b, 0x200f, 0}, {0x20d0, 0x20ff, 0}, {0x231a, 0x231b, 2}, {0x2329, 0x232a, 2},
+    {0x23e9, 0x23ec, 2}, {0x25fd, 0x25fe, 2}, {0x2614, 0x2615, 2}, {0x2648, 0x2653, 2}, {0x26aa, 0x26ab, 2},
+    {0x26bd, 0x26be, 2}, {0x26c4, 0x26c5, 2}, {0x26f2, 0x26f5, 2}, {0x2705, 0x2705, 2}, {0x270a, 0x270b, 2},
+    {0x274c, 0x274c, 2}, {0x2753, 0x2755, 2}, {0x2795, 0x2797, 2}, {0x2b1b, 0x2b1c, 2}, {0x2e80, 0x303e, 2},
+    {0x3041, 0x3098, 2}, {0x3099, 0x309a, 0}, {0x309b, 0x33ff, 2}, {0x3400, 0x4dbf, 2}, {0x4e00, 0x9fff, 2},
+    {0xa000, 0xa4cf, 2}, {0xa960, 0xa97f, 2}, {0xac00, 0xd7a3, 2}, {0xf900, 0xfaff, 2}, {0xfe00, 0xfe0f, 0},
+    {0xfe10, 0xfe19, 2}, {0xfe20, 0xfe2f, 0}, {0xfe30, 0xfe6f, 2}, {0xff00, 0xff60, 2}, {0xffe0, 0xffe6, 2},
+    {0x16fe0, 0x16fe4, 2}, {0x17000, 0x18aff, 2}, {0x1b000, 0x1b2ff, 2}, {0x1f004, 0x1f004, 2}, {0x1f0cf, 0x1f0cf, 2},
+    {0x1f18e, 0x1f18e, 2}, {0x1f191, 0x1f19a, 2}, {0x1f200, 0x1f251, 2}, {0x1f300, 0x1f64f, 2}, {0x1f680, 0x1f6ff, 2},
+    {0x1f900, 0x1f9ff, 2}, {0x1fa70, 0x1faff, 2}, {0x20000, 0x2fffd, 2}, {0x30000, 0x3fffd, 2}, {0xe0100, 0xe01ef, 0},
+};
+
+#define WIDTH_TABLE_ENTRIES (sizeof(widthTable) / sizeof(widthTable[0]))
+
+signed char widthCache[0x10000]; //width+1 of basic plane code points already looked up, 0 if not yet
+
+int utf8Width(int cp){
+    if(cp < 0x300) return 1;
+    if(cp < 0x10000 && widthCache[cp]) return widthCache[cp]-1;
+
+    int width = 1;
+    int lo = 0, hi = WIDTH_TABLE_ENTRIES-1;
+    while(lo <= hi){
+        int mid = (lo+hi)/2;
+        if(cp < widthTable[mid].lo) hi = mid-1;
+        else if(cp > widthTable[mid].hi) lo = mid+1;
+        else {
+            width = widthTable[mid].width;
+            break;
+        }
+    }
+    if(cp < 0x10000) widthCache[cp] = width+1;
+    return width;
+}
+
+int utf8IsCont(char c){
+    return (c & 0xc0) == 0x80;
+}
+
+//decode the sequence at s, returns how many bytes it takes and sets cp to -1 if it is not valid utf-8
+int utf8Decode(const char *s, int len, int *cp){
+    unsigned char c = s[0];
+    int n;
+    if(c < 0x80){
+        *cp = c;
+        return 1;
+    }
+    else if((c & 0xe0) == 0xc0){ n = 2; *cp = c & 0x1f; }
+    else if((c & 0xf0) == 0xe0){ n = 3; *cp = c & 0x0f; }
+    else if((c & 0xf8) == 0xf0){ n = 4; *cp = c & 0x07; }
+    else {
+        *cp = -1;
+        return 1;
+    }
+    if(n > len){
+        *cp = -1;
+        return 1;
+    }
+    for(int i=1;i<n;i++){
+        if(!utf8IsCont(s[i])){
+            *cp = -1;
+            return 1;
+        }
+        *cp = (*cp << 6) | (s[i] & 0x3f);
+    }
+    //overlong forms, surrogates and values past unicode
+    static const int minimum[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    if(*cp < minimum[n] || (*cp >= 0xd800 && *cp <= 0xdfff) || *cp > 0x10ffff) *cp = -1;
+    return *cp == -1 ? 1 : n;
+}
+
+//checks 16 bytes at a time with sse2, 8 at a time otherwise
+int utf8IsAscii(const char *s, int len){
+    int i = 0;
+#ifdef __SSE2__
+    for(;i+16<=len;i+=16){
+        if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&s[i]))) return 0;
+    }
+#else
+    for(;i+8<=len;i+=8){
+        uint64_t w;
+        memcpy(&w, &s[i], 8);
+        if(w & 0x8080808080808080ull) return 0;
+    }
+#endif
+    for(;i<len;i++){
+        if(s[i] & 0x80) return 0;
+    }
+    return 1;
+}
+
+//width of the character at s in render, which only ever holds valid utf-8
+int utf8RenderChar(const char *s, int len, int *width){
+    if(!(s[0] & 0x80)){
+        *width = 1;
+        return 1;
+    }
+    int cp;
+    int n = utf8Decode(s, len, &cp);
+    *width = cp < 0 ? 1 : utf8Width(cp);
+    return n;
+}
+
 /*** syntax highlighting ***/
 
 int editorSyntaxToColor(int hl){
     switch (hl){
+        case HL_NORMAL: return 39;
         case HL_NUMBER: return 31;
         case HL_MATCH: return 34;
         case HL_STRING: return 35;
@@ -264,48 +1069,54 @@ int editorSyntaxToColor(int hl){
     }
 }
 
+void editorInitColors(){
+    for(int hl=0;hl<HL_CLASSES;hl++){
+        hlColors[hl].color = editorSyntaxToColor(hl);
+        hlColors[hl].len = snprintf(hlColors[hl].seq,sizeof(hlColors[hl].seq),"\x1b[%dm",hlColors[hl].color);
+    }
+}
+
 int isSeparator(int c){
     return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];",c) != NULL;
 }
 
-void editorUpdateSyntax(erow *row){
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
-
-    if(E.syntax == NULL) return;
+//highlight one line of render text entering in the given multi line comment state
+//touches nothing but hl so it can run on any thread, returns the state at the end of the line
+int editorHighlightLine(struct editorSyntax *syntax, char *render, int rsize, unsigned char *hl, int inComment){
+    memset(hl, HL_NORMAL, rsize);
+    if(syntax == NULL) return 0;
 
     int prevSep = 1;
     int inString = 0;
-    int inComment = (row->idx > 0 && E.row[row->idx-1].hlOpenComment);
 
-    char **keywords = E.syntax->keywords;
+    char **keywords = syntax->keywords;
 
-    char *scs = E.syntax->singleLineCommentStart;
-    char *mcs = E.syntax->mlCommentStart;
-    char *mce = E.syntax->mlCommentEnd;
+    char *scs = syntax->singleLineCommentStart;
+    char *mcs = syntax->mlCommentStart;
+    char *mce = syntax->mlCommentEnd;
 
     int scsLen = scs?strlen(scs):0;
     int mcsLen = mcs?strlen(mcs):0;    
     int mceLen = mce?strlen(mce):0;
 
     int i=0;
-    while(i < row->rsize){
-        char c = row->render[i];
-        unsigned char prevHl = (i>0)?row->hl[i-1] : HL_NORMAL;
+    while(i < rsize){
+        char c = render[i];
+        unsigned char prevHl = (i>0)?hl[i-1] : HL_NORMAL;
 
     //single line comments
         if(scsLen && !inString && !inComment){
-            if(!strncmp(&row->render[i],scs,scsLen)){
-                memset(&row->hl[i], HL_COMMENT, row->rsize-i);
+            if(!strncmp(&render[i],scs,scsLen)){
+                memset(&hl[i], HL_COMMENT, rsize-i);
                 break;
             }
         }
     //multi line comments
     if(mcsLen && mceLen && !inString){
         if(inComment){
-            row->hl[i] = HL_MLCOMMENT;
-            if(!strncmp(&row->render[i],mce,mceLen)){
-                memset(&row->hl[i],HL_MLCOMMENT,mceLen);
+            hl[i] = HL_MLCOMMENT;
+            if(!strncmp(&render[i],mce,mceLen)){
+                memset(&hl[i],HL_MLCOMMENT,mceLen);
                 i += mceLen;
                 inComment = 0;
                 prevSep = 1;
@@ -314,8 +1125,8 @@ void editorUpdateSyntax(erow *row){
             i++;
             continue;
         }
-        else if(!strncmp(&row->render[i],mcs,mcsLen)){
-            memset(&row->hl[i],HL_MLCOMMENT,mcsLen);
+        else if(!strncmp(&render[i],mcs,mcsLen)){
+            memset(&hl[i],HL_MLCOMMENT,mcsLen);
             i += mcsLen;
             inComment = 1;
             continue;
@@ -323,11 +1134,11 @@ void editorUpdateSyntax(erow *row){
     }
 
     //strings
-        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS){
+        if(syntax->flags & HL_HIGHLIGHT_STRINGS){
             if(inString){
-                row->hl[i] = HL_STRING;
-                if(c == '\\' && i+1 < row->rsize){ //escaped characters inside string
-                    row->hl[i+1] = HL_STRING;
+                hl[i] = HL_STRING;
+                if(c == '\\' && i+1 < rsize){ //escaped characters inside string
+                    hl[i+1] = HL_STRING;
                     i += 2;
                     continue;
                 }
@@ -339,16 +1150,16 @@ void editorUpdateSyntax(erow *row){
             else {
                 if(c == '"' || c == '\''){
                     inString = c;
-                    row->hl[i] = HL_STRING;
+                    hl[i] = HL_STRING;
                     i++;
                     continue;
                 }
             }
         }
     //numbers
-        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS){
+        if(syntax->flags & HL_HIGHLIGHT_NUMBERS){
             if((isdigit(c) && (prevSep || prevHl == HL_NUMBER)) || (c == '.' && prevHl == HL_NUMBER)) {
-            row->hl[i] = HL_NUMBER;
+            hl[i] = HL_NUMBER;
             i++;
             prevSep = 0;
             continue;
@@ -361,8 +1172,8 @@ void editorUpdateSyntax(erow *row){
                 int kw2 = keywords[j][klen-1] == '|';
                 if(kw2) klen--;
 
-                if(!strncmp(&row->render[i],keywords[j],klen) && isSeparator(row->render[i+klen])){
-                    memset(&row->hl[i],kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                if(!strncmp(&render[i],keywords[j],klen) && isSeparator(render[i+klen])){
+                    memset(&hl[i],kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
                     i += klen;
                     break;
                 }
@@ -377,13 +1188,146 @@ void editorUpdateSyntax(erow *row){
         i++;
     }
 
+    return inComment;
+}
+
+void editorUpdateSyntax(erow *row){
+    E.perf.hlrows++;
+    editorRowLoad(row);
+
+    int inComment = (E.syntax && row->idx > 0 && E.row[row->idx-1].hlOpenComment);
+    uint64_t hash = editorHashRender(row->render, row->rsize);
+    struct hlEntry *e = editorHlCacheFind(hash, row, inComment);
+    if(e == NULL){
+        unsigned char *hl = malloc(row->rsize);
+        int outComment = editorHighlightLine(E.syntax, row->render, row->rsize, hl, inComment);
+        e = editorHlCacheAdd(hash, row, inComment, outComment, hl);
+    }
+    if(row->hlShared != e) editorRowShareHl(row, e);
+
+    if(E.syntax == NULL) return;
+    inComment = e->outComment;
+
     int changed = (row->hlOpenComment != inComment);
     row->hlOpenComment = inComment;
-    if(changed && row->idx + 1 < E.numrows){
+    if(changed && row->idx + 1 < E.numrows && row->idx + 1 < E.hlFrontier){
         editorUpdateSyntax(&E.row[row->idx+1]);
     }
 }
 
+//make sure every row before filerow has been highlighted
+void editorHighlightUpTo(int filerow){
+    if(filerow > E.numrows) filerow = E.numrows;
+    if(E.hlFrontier >= filerow) return;
+
+    uint64_t start = perfNow();
+    while(E.hlFrontier < filerow){
+        editorUpdateSyntax(&E.row[E.hlFrontier]);
+        E.hlFrontier++;
+    }
+    perfAddSpan(PERF_SYNTAX, start);
+}
+
+int editorHighlightJob(uint64_t deadline){
+    while(E.hlFrontier < E.numrows){
+        editorUpdateSyntax(&E.row[E.hlFrontier]);
+        E.hlFrontier++;
+        if((E.hlFrontier & 63) == 0 && perfNow() >= deadline) break;
+    }
+    return E.hlFrontier < E.numrows;
+}
+
+/*
+full file highlighting split across threads
+every chunk is highlighted entering outside a comment straight into the rows, then again entering
+inside one into side buffers until both runs leave a row in the same state, after which they agree
+a sequential pass then swaps in the side buffers of chunks that really start inside a comment
+*/
+
+struct hlChunk{
+    struct editorSyntax *syntax;
+    int start, end; //rows [start, end)
+    int converged; //rows from here on are the same for both entry states
+    unsigned char **alt; //highlight of rows [start, converged) when entering inside a comment
+    int *altOpen; //hlOpenComment of those rows
+};
+
+void *editorHighlightChunk(void *arg){
+    struct hlChunk *c = arg;
+
+    int state = 0;
+    for(int i=c->start;i<c->end;i++){
+        erow *row = &E.row[i];
+        editorRowLoad(row);
+        row->hl = malloc(row->rsize);
+        state = editorHighlightLine(c->syntax, row->render, row->rsize, row->hl, state);
+        row->hlOpenComment = state;
+    }
+
+    c->converged = c->start;
+    if(c->start == 0) return NULL; //the first row never starts inside a comment
+
+    state = 1;
+    for(int i=c->start;i<c->end;i++){
+        erow *row = &E.row[i];
+        unsigned char *hl = malloc(row->rsize);
+        state = editorHighlightLine(c->syntax, row->render, row->rsize, hl, state);
+        c->alt[i - c->start] = hl;
+        c->altOpen[i - c->start] = state;
+        c->converged = i+1;
+        if(state == row->hlOpenComment) break;
+    }
+    return NULL;
+}
+
+void editorHighlightParallel(int nthreads){
+    struct hlChunk chunks[QUILLO_MAX_HL_THREADS];
+    pthread_t threads[QUILLO_MAX_HL_THREADS];
+    int started[QUILLO_MAX_HL_THREADS];
+
+    //workers write private hl buffers, the cache is only touched from this thread
+    for(int i=0;i<E.numrows;i++) editorRowReleaseHl(&E.row[i]);
+
+    int per = (E.numrows + nthreads - 1) / nthreads;
+    for(int t=0;t<nthreads;t++){
+        struct hlChunk *c = &chunks[t];
+        c->syntax = E.syntax;
+        c->start = t * per;
+        c->end = (t+1) * per < E.numrows ? (t+1) * per : E.numrows;
+        c->alt = malloc(sizeof(*c->alt) * per);
+        c->altOpen = malloc(sizeof(*c->altOpen) * per);
+        started[t] = (t > 0 && pthread_create(&threads[t], NULL, editorHighlightChunk, c) == 0);
+    }
+    //the main thread takes the first chunk and any chunk a thread could not be started for
+    for(int t=0;t<nthreads;t++){
+        if(!started[t]) editorHighlightChunk(&chunks[t]);
+    }
+
+    int state = 0;
+    for(int t=0;t<nthreads;t++){
+        struct hlChunk *c = &chunks[t];
+        if(started[t]) pthread_join(threads[t], NULL);
+
+        for(int i=c->start;i<c->converged;i++){
+            unsigned char *hl = c->alt[i - c->start];
+            if(state){
+                free(E.row[i].hl);
+                E.row[i].hl = hl;
+                E.row[i].hlOpenComment = c->altOpen[i - c->start];
+            } else {
+                free(hl);
+            }
+        }
+        if(c->end > c->start) state = E.row[c->end-1].hlOpenComment;
+        free(c->alt);
+        free(c->altOpen);
+    }
+    for(int i=0;i<E.numrows;i++){
+        editorRowInternHl(&E.row[i], i > 0 && E.row[i-1].hlOpenComment);
+    }
+    E.perf.hlrows += E.numrows;
+}
+
 void editorSelectSyntaxHL(){
     E.syntax = NULL;
     if(E.filename == NULL) return;
@@ -398,10 +1342,26 @@ void editorSelectSyntaxHL(){
             if((is_ext && ext && !strcmp(ext,s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))){
                 E.syntax = s;
 
-                for(int filerow = 0;filerow < E.numrows; filerow++){
-                    editorUpdateSyntax(&E.row[filerow]);
+                if(E.hlStates == s){ //restored from the line index, rows get highlighted as they are drawn
+                    E.hlStates = NULL;
+                    E.hlFrontier = E.numrows;
+                    return;
+                }
+
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                if(ncpu > QUILLO_MAX_HL_THREADS) ncpu = QUILLO_MAX_HL_THREADS;
+                if(ncpu > 1 && E.numrows >= QUILLO_PARALLEL_HL_ROWS){
+                    uint64_t start = perfNow();
+                    editorHighlightParallel(ncpu);
+                    E.hlFrontier = E.numrows;
+                    perfAddSpan(PERF_SYNTAX, start);
+                    return;
                 }
 
+                //visible rows get highlighted when drawn, the rest while idle
+                E.hlFrontier = 0;
+                editorScheduleJob(editorHighlightJob);
+
                 return;
             }
             i++;
@@ -409,80 +1369,666 @@ void editorSelectSyntaxHL(){
     }
 }
 
-/*** row operations ***/
+/*** row indexes ***/
 
-int editorRowCxToRx(erow *row, int cx){
-    int rx = 0;
-    int j;
-    for(j=0; j<cx; j++){
-        if(row->chars[j] == '\t')
-            rx += (QUILLO_TAB_STOP -1) - (rx % QUILLO_TAB_STOP);
-        rx++;
+void rowShiftPrepare(struct rowShift *s, int n){
+    int sum = 0;
+    for(int j=0;j<n;j++){
+        s[j].before = sum;
+        sum += s[j].delta;
     }
-    return rx;
 }
 
-int editorRowRxToCx(erow *row, int rx){
-    int cur_rx = 0;
-    int cx;
-    for(cx = 0; cx < row->size; cx++){
-        if(row->chars[cx] == '\t'){
-            cur_rx += (QUILLO_TAB_STOP - 1) - (cur_rx % QUILLO_TAB_STOP);
-        }
-        cur_rx++;
-        if(cur_rx > rx) return cx;
+//where row r is after changes sorted by at, a deleted row gives the row that now follows the deletion
+int rowShiftMap(const struct rowShift *s, int n, int r, int *gone){
+    int lo = 0, hi = n;
+    while(lo < hi){ //first change after r
+        int mid = lo + (hi-lo)/2;
+        if(s[mid].at <= r) lo = mid+1;
+        else hi = mid;
     }
-    return cx;
+    *gone = 0;
+    if(lo == 0) return r;
+    const struct rowShift *c = &s[lo-1];
+    if(c->delta < 0 && r < c->at - c->delta){
+        *gone = 1;
+        return c->at + c->before;
+    }
+    return r + c->before + c->delta;
 }
 
-void editorUpdateRow(erow *row){
-    int tabs = 0;
-    int j;
-    for(j=0; j<row->size; j++){
-        if(row->chars[j] == '\t') tabs++;
+void rowIndexBuild(struct rowIndex *ix){
+    if(ix->cap < E.numrows+1){
+        ix->cap = E.numrows+1;
+        ix->tree = realloc(ix->tree, sizeof(int64_t) * ix->cap);
+    }
+    ix->n = E.numrows;
+    ix->stale = 0;
+    ix->from = INT_MAX;
+    for(int i=1;i<=ix->n;i++) ix->tree[i] = ix->weight(&E.row[i-1]);
+    for(int i=1;i<=ix->n;i++){ //linear time build, push every node into its parent
+        int parent = i + (i & -i);
+        if(parent <= ix->n) ix->tree[parent] += ix->tree[i];
     }
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs* (QUILLO_TAB_STOP-1) +1);
+//total weight of the first rows rows
+int64_t rowIndexPrefix(struct rowIndex *ix, int rows){
+    int64_t sum = 0;
+    for(int i=rows;i>0;i -= i & -i) sum += ix->tree[i];
+    return sum;
+}
 
-    int idx = 0;
-    for(j=0; j<row->size; j++){
-        if(row->chars[j]!='\t'){
-            row->render[idx++] = row->chars[j];
-            continue;
-        }
-        row->render[idx++] = ' ';
-        while(idx % QUILLO_TAB_STOP != 0) row->render[idx++] = ' ';
+//weigh the rows from from on again, nodes only covering rows before it are still right and kept
+void rowIndexBuildFrom(struct rowIndex *ix, int from){
+    if(from > ix->n) from = ix->n;
+    if(ix->cap < E.numrows+1){
+        ix->cap = ix->cap * 2 > E.numrows+1 ? ix->cap * 2 : E.numrows+1;
+        ix->tree = realloc(ix->tree, sizeof(int64_t) * ix->cap);
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    ix->n = E.numrows;
+    ix->from = INT_MAX;
+    //prefix sums first, then going down every node takes off the prefix below its range
+    int64_t sum = rowIndexPrefix(ix, from);
+    for(int i=from+1;i<=ix->n;i++){
+        sum += ix->weight(&E.row[i-1]);
+        ix->tree[i] = sum;
+    }
+    for(int i=ix->n;i>from;i--){
+        int low = i - (i & -i);
+        ix->tree[i] -= low > from ? ix->tree[low] : rowIndexPrefix(ix, low);
+    }
+}
 
-    editorUpdateSyntax(row);
+void rowIndexEnsure(struct rowIndex *ix){
+    if(ix->stale || ix->tree == NULL || (ix->n != E.numrows && ix->from == INT_MAX)) rowIndexBuild(ix);
+    else if(ix->from != INT_MAX) rowIndexBuildFrom(ix, ix->from);
 }
 
-void editorInsertRow(int at,char *s, size_t len){
-    if(at < 0 || at > E.numrows) return;
-    
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows+1));
-    memmove(&E.row[at+1], &E.row[at], sizeof(erow)*(E.numrows - at));
-    for(int j=at+1; j<=E.numrows;j++) E.row[j].idx++;
+//rows from at on were added, removed or moved, the ones before it keep their weights
+void rowIndexShifted(struct rowIndex *ix, int at){
+    if(at < ix->from) ix->from = at;
+}
 
-    E.row[at].idx = at;
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars,s,len);
-    E.row[at].chars[len] = '\0';
-    E.row[at].render = NULL;
-    E.row[at].rsize = 0;
-    E.row[at].hl = NULL;
-    E.row[at].hlOpenComment = 0;
+//find the row position v falls in and how far into that row it is, past the end gives E.numrows
+void rowIndexFind(struct rowIndex *ix, int64_t v, int *filerow, int64_t *rem){
+    int pos = 0;
+    int step = 1;
+    while(step*2 <= ix->n) step *= 2;
+    for(;step;step /= 2){
+        if(pos+step <= ix->n && ix->tree[pos+step] <= v){
+            pos += step;
+            v -= ix->tree[pos];
+        }
+    }
+    *filerow = pos;
+    *rem = v;
+}
 
-    editorUpdateRow(&E.row[at]);
+//bring one row's weight up to date without rebuilding
+void rowIndexUpdate(struct rowIndex *ix, erow *row){
+    if(ix->tree == NULL || ix->stale || row->idx >= ix->n || row->idx >= ix->from) return;
+    int64_t old = rowIndexPrefix(ix, row->idx+1) - rowIndexPrefix(ix, row->idx);
+    int64_t delta = ix->weight(row) - old;
+    if(delta == 0) return;
+    for(int i=row->idx+1;i<=ix->n;i += i & -i) ix->tree[i] += delta;
+}
+
+//account for a row just added at the end, O(log n) instead of a rebuild
+void rowIndexAppend(struct rowIndex *ix){
+    if(ix->tree != NULL && !ix->stale && ix->from < E.numrows) return; //weighed with the rest from there on
+    if(ix->tree == NULL || ix->stale || ix->n != E.numrows-1){
+        ix->stale = 1;
+        return;
+    }
+    if(ix->cap < E.numrows+1){
+        ix->cap = ix->cap * 2 > E.numrows+1 ? ix->cap * 2 : E.numrows+1;
+        ix->tree = realloc(ix->tree, sizeof(int64_t) * ix->cap);
+    }
+    int i = E.numrows;
+    //a node holds its own weight plus the nodes below it, which are prefix(i-1) - prefix(i - lowbit(i))
+    ix->tree[i] = ix->weight(&E.row[i-1]) + rowIndexPrefix(ix, i-1) - rowIndexPrefix(ix, i - (i & -i));
+    ix->n = i;
+}
+
+//byte offset where row at starts, the pager has it on every row already
+int64_t editorRowOffset(int at){
+    if(E.pager.active) return at < E.numrows ? E.row[at].offset : E.pager.total;
+    rowIndexEnsure(&E.bytes);
+    return rowIndexPrefix(&E.bytes, at);
+}
+
+int64_t editorRowBytes(erow *row){
+    return row->size + row->eol;
+}
+
+/*** soft wrap ***/
+
+/*
+go through the screen lines of a row that is not ascii, a line ends early when the next character would not fit
+so wide characters are never cut, stops at line sub or at the line column rx is on and gives where that line starts
+*/
+int editorWrapWalk(erow *row, int sub, int rx, int *start){
+    int at = 0, col = 0, line = 0, from = 0, w;
+    while(at < row->rsize && line < sub){
+        int n = utf8RenderChar(&row->render[at], row->rsize - at, &w);
+        if(col > from && col + w - from > E.screencols){
+            line++;
+            from = col;
+        }
+        if(col >= rx) break;
+        col += w;
+        at += n;
+    }
+    *start = from;
+    return line;
+}
+
+int64_t editorWrapLines(erow *row){
+    if(editorFoldAt(row->idx) != -1) return 0; //folded away
+    if(row->wraps && E.wrapcols == E.screencols) return row->wraps; //counted without loading the row again
+    int lazy = (row->render == NULL);
+    editorRowLoad(row);
+    int start;
+    int64_t lines = row->ascii ? (row->rcols > 0 ? (row->rcols-1) / E.screencols + 1 : 1) : editorWrapWalk(row, INT_MAX, INT_MAX, &start) + 1;
+    if(lazy) editorRowUnload(row);
+    if(E.wrapcols == E.screencols) row->wraps = lines;
+    return lines;
+}
+
+//screen column wrapped line sub of a loaded row starts at
+int editorWrapStart(erow *row, int sub){
+    int start = sub * E.screencols;
+    if(!row->ascii) editorWrapWalk(row, sub, INT_MAX, &start);
+    return start;
+}
+
+//wrapped line column rx of a loaded row is on, the end of a full line stays on it
+int editorWrapSub(erow *row, int rx, int *start){
+    if(row->ascii){
+        int lines = row->rcols > 0 ? (row->rcols-1) / E.screencols + 1 : 1;
+        int sub = rx / E.screencols;
+        if(sub > lines-1) sub = lines-1;
+        *start = sub * E.screencols;
+        return sub;
+    }
+    return editorWrapWalk(row, INT_MAX, rx, start);
+}
+
+void editorWrapEnsure(){
+    if(E.wrapcols != E.screencols){
+        E.wrapcols = E.screencols;
+        E.wrap.stale = 1;
+        for(int j=0;j<E.numrows;j++) E.row[j].wraps = 0;
+    }
+    rowIndexEnsure(&E.wrap);
+}
+
+int editorWrapPrefix(int rows){
+    return rowIndexPrefix(&E.wrap, rows);
+}
+
+//map a screen line to the row that contains it and the line within that row
+void editorWrapFind(int v, int *filerow, int *sub){
+    int64_t rem;
+    rowIndexFind(&E.wrap, v, filerow, &rem);
+    *sub = rem;
+}
+
+//screen line the cursor is on, counted from the top of the file
+int editorWrapCursorLine(){
+    int v = editorWrapPrefix(E.cy);
+    if(E.cy < E.numrows && editorFoldAt(E.cy) == -1){
+        int start;
+        editorRowLoad(&E.row[E.cy]);
+        v += editorWrapSub(&E.row[E.cy], E.rx, &start);
+    }
+    return v;
+}
+
+/*** folding ***/
+
+//outermost folds are the ones not inside an earlier fold, all is ordered so one pass finds them
+void editorFoldUpdateTop(){
+    struct fold *old = E.folds.top;
+    int nold = E.folds.ntop;
+    E.folds.top = malloc(sizeof(struct fold) * (E.folds.count ? E.folds.count : 1));
+    E.folds.ntop = 0;
+    for(int j=0;j<E.folds.count;j++){
+        struct fold *f = &E.folds.all[j];
+        if(E.folds.ntop && f->start <= E.folds.top[E.folds.ntop-1].end) continue;
+        E.folds.top[E.folds.ntop++] = *f;
+    }
+    //hidden rows take no screen lines, rows before the first fold that changed keep theirs
+    int k = 0;
+    while(k < nold && k < E.folds.ntop && old[k].start == E.folds.top[k].start && old[k].end == E.folds.top[k].end) k++;
+    if(k < nold || k < E.folds.ntop){
+        int from = k < nold ? old[k].start : INT_MAX;
+        if(k < E.folds.ntop && E.folds.top[k].start < from) from = E.folds.top[k].start;
+        rowIndexShifted(&E.wrap, from+1);
+    }
+    free(old);
+}
+
+//index of the outermost fold hiding filerow, -1 when it is visible
+int editorFoldAt(int filerow){
+    int lo = 0, hi = E.folds.ntop;
+    while(lo < hi){ //first fold starting at or after filerow
+        int mid = lo + (hi-lo)/2;
+        if(E.folds.top[mid].start < filerow) lo = mid+1;
+        else hi = mid;
+    }
+    if(lo > 0 && filerow <= E.folds.top[lo-1].end) return lo-1;
+    return -1;
+}
+
+//visible row after filerow, every fold in the way is jumped in one step
+int editorFoldNext(int filerow){
+    int f = editorFoldAt(filerow+1);
+    return f == -1 ? filerow+1 : E.folds.top[f].end+1;
+}
+
+int editorFoldPrev(int filerow){
+    int f = editorFoldAt(filerow-1);
+    return f == -1 ? filerow-1 : E.folds.top[f].start;
+}
+
+//open every fold that hides filerow
+void editorFoldReveal(int filerow){
+    if(editorFoldAt(filerow) == -1) return;
+    int n = 0;
+    for(int j=0;j<E.folds.count;j++){
+        struct fold *f = &E.folds.all[j];
+        if(f->start < filerow && filerow <= f->end) continue;
+        E.folds.all[n++] = *f;
+    }
+    E.folds.count = n;
+    editorFoldUpdateTop();
+}
+
+//keep folds on the same text through a batch of inserted and deleted rows
+void editorFoldRemap(const struct rowShift *s, int n){
+    if(E.folds.count == 0) return;
+    int m = 0;
+    for(int j=0;j<E.folds.count;j++){
+        struct fold f = E.folds.all[j];
+        int gone;
+        f.start = rowShiftMap(s, n, f.start, &gone);
+        if(gone) continue; //its first row is gone
+        f.end = rowShiftMap(s, n, f.end, &gone);
+        if(gone) f.end--; //ends on the row before the deletion
+        if(f.end <= f.start) continue;
+        E.folds.all[m++] = f;
+    }
+    E.folds.count = m;
+    editorFoldUpdateTop();
+}
+
+//delta rows inserted at at, or -delta rows from at on deleted
+void editorFoldShift(int at, int delta){
+    struct rowShift s = { at, delta, 0 };
+    editorFoldRemap(&s, 1);
+}
+
+//depth change over a row counting only brackets the highlighter left as code
+int editorFoldBrackets(erow *row){
+    if(row->brKnown) return row->brDelta;
+    int depth, lowest;
+    editorBracketCount(row->render, row->hl, row->rsize, &depth, &lowest);
+    return depth;
+}
+
+int editorFoldIndent(erow *row){
+    int j = 0;
+    while(j < row->rsize && isspace(row->render[j])) j++;
+    return j == row->rsize ? -1 : j; //blank rows have no indent of their own
+}
+
+//rows hidden by folding at, up to the bracket it leaves open or else the deeper indented block after it
+int editorFoldRegion(int at){
+    editorHighlightUpTo(at+1);
+    erow *row = &E.row[at];
+    if(row->hl == NULL) editorUpdateSyntax(row);
+    int depth = editorFoldBrackets(row);
+
+    int base = editorFoldIndent(row);
+    int end = at;
+    for(int j=at+1;j<E.numrows;j++){
+        row = &E.row[j];
+        int lazy = (row->render == NULL);
+        editorHighlightUpTo(j+1);
+        if(row->hl == NULL) editorUpdateSyntax(row);
+
+        int stop;
+        if(depth > 0){
+            depth += editorFoldBrackets(row);
+            stop = (depth <= 0);
+            if(stop) end = j;
+        } else {
+            int indent = editorFoldIndent(row);
+            stop = (indent != -1 && indent <= base);
+            if(!stop && indent != -1) end = j;
+        }
+        if(lazy) editorRowUnload(row);
+        if(stop) break;
+    }
+    return end;
+}
+
+//close a fold on the cursor row, or open the one that starts there
+void editorFoldToggle(){
+    if(E.cy >= E.numrows) return;
+    for(int j=0;j<E.folds.count;j++){
+        if(E.folds.all[j].start != E.cy) continue;
+        E.folds.count--;
+        memmove(&E.folds.all[j], &E.folds.all[j+1], sizeof(struct fold) * (E.folds.count - j));
+        editorFoldUpdateTop();
+        return;
+    }
+
+    int end = editorFoldRegion(E.cy);
+    if(end == E.cy){
+        editorSetStatusMessage("Nothing to fold");
+        return;
+    }
+    if(E.folds.count == E.folds.cap){
+        E.folds.cap = E.folds.cap ? E.folds.cap * 2 : 16;
+        E.folds.all = realloc(E.folds.all, sizeof(struct fold) * E.folds.cap);
+    }
+    int j = E.folds.count;
+    while(j > 0 && E.folds.all[j-1].start > E.cy){
+        E.folds.all[j] = E.folds.all[j-1];
+        j--;
+    }
+    E.folds.all[j].start = E.cy;
+    E.folds.all[j].end = end;
+    E.folds.count++;
+    editorFoldUpdateTop();
+}
+
+/*** row operations ***/
+
+//columns taken by the character of chars at j, tabs included, returns its length in bytes
+int editorCharWidth(erow *row, int j, int rx, int *width){
+    if(row->chars[j] == '\t'){
+        *width = QUILLO_TAB_STOP - (rx % QUILLO_TAB_STOP);
+        return 1;
+    }
+    if(row->ascii){
+        *width = 1;
+        return 1;
+    }
+    int cp;
+    int n = utf8Decode(&row->chars[j], row->size - j, &cp);
+    *width = (cp < 0 || (cp >= 0x80 && cp < 0xa0)) ? 1 : utf8Width(cp);
+    return n;
+}
+
+int editorRowCxToRx(erow *row, int cx){
+    int rx = 0;
+    int j;
+    if(row->ascii){
+        for(j=0; j<cx; j++){
+            if(row->chars[j] == '\t')
+                rx += (QUILLO_TAB_STOP -1) - (rx % QUILLO_TAB_STOP);
+            rx++;
+        }
+        return rx;
+    }
+    for(j=0; j<cx;){
+        int width;
+        j += editorCharWidth(row, j, rx, &width);
+        rx += width;
+    }
+    return rx;
+}
+
+int editorRowRxToCx(erow *row, int rx){
+    int cur_rx = 0;
+    int cx;
+    if(row->ascii){
+        for(cx = 0; cx < row->size; cx++){
+            if(row->chars[cx] == '\t'){
+                cur_rx += (QUILLO_TAB_STOP - 1) - (cur_rx % QUILLO_TAB_STOP);
+            }
+            cur_rx++;
+            if(cur_rx > rx) return cx;
+        }
+        return cx;
+    }
+    for(cx = 0; cx < row->size;){
+        int width;
+        int n = editorCharWidth(row, cx, cur_rx, &width);
+        cur_rx += width;
+        if(cur_rx > rx) return cx;
+        cx += n;
+    }
+    return cx;
+}
+
+//byte of render that chars[cx] ends up at, tabs expand and broken sequences shrink to one ?
+int editorRowCxToRender(erow *row, int cx){
+    if(row->ascii) return editorRowCxToRx(row, cx);
+    int at = 0, rx = 0;
+    for(int j=0;j<cx && j<row->size;){
+        int width;
+        int n = editorCharWidth(row, j, rx, &width);
+        if(row->chars[j] == '\t') at += width;
+        else if(n == 1 && (row->chars[j] & 0x80)) at++;
+        else if(n == 2 && (unsigned char)row->chars[j] == 0xc2 && (unsigned char)row->chars[j+1] < 0xa0) at++;
+        else at += n;
+        rx += width;
+        j += n;
+    }
+    return at;
+}
+
+//screen column of a byte offset into render
+int editorRenderByteToCol(erow *row, int at){
+    if(row->ascii) return at;
+    int col = 0;
+    for(int j=0;j<at;){
+        int width;
+        j += utf8RenderChar(&row->render[j], row->rsize - j, &width);
+        col += width;
+    }
+    return col;
+}
+
+void editorUpdateRender(erow *row){
+    int tabs = 0;
+    int j;
+    for(j=0; j<row->size; j++){
+        if(row->chars[j] == '\t') tabs++;
+    }
+
+    free(row->render);
+    row->render = malloc(row->size + tabs* (QUILLO_TAB_STOP-1) +1);
+    row->ascii = utf8IsAscii(row->chars, row->size);
+
+    int idx = 0;
+    if(row->ascii){
+        for(j=0; j<row->size; j++){
+            if(row->chars[j]!='\t'){
+                row->render[idx++] = row->chars[j];
+                continue;
+            }
+            row->render[idx++] = ' ';
+            while(idx % QUILLO_TAB_STOP != 0) row->render[idx++] = ' ';
+        }
+        row->render[idx] = '\0';
+        row->rsize = idx;
+        row->rcols = idx;
+        return;
+    }
+
+    //tab stops go by columns, bytes that are not valid utf-8 show up as ?
+    int col = 0;
+    for(j=0; j<row->size;){
+        int width;
+        int n = editorCharWidth(row, j, col, &width);
+        if(row->chars[j] == '\t'){
+            memset(&row->render[idx], ' ', width);
+            idx += width;
+        } else if(n == 1 && (row->chars[j] & 0x80)){
+            row->render[idx++] = '?';
+        } else if(n == 2 && (unsigned char)row->chars[j] == 0xc2 && (unsigned char)row->chars[j+1] < 0xa0){
+            row->render[idx++] = '?'; //c1 control codes
+        } else {
+            memcpy(&row->render[idx], &row->chars[j], n);
+            idx += n;
+        }
+        col += width;
+        j += n;
+    }
+    row->render[idx] = '\0';
+    row->rsize = idx;
+    row->rcols = col;
+}
+
+void editorSpanRelease(struct clipSpan *span){
+    if(--span->refs > 0) return;
+    for(int j=0;j<span->nlines;j++){
+        if(span->owner[j] == span) free(span->chars[j]);
+        else editorSpanRelease(span->owner[j]);
+    }
+    free(span->chars);
+    free(span->sizes);
+    free(span->owner);
+    free(span->open);
+    free(span->brDelta);
+    free(span->brMin);
+    if(span->sym){
+        for(int j=0;j<span->nlines;j++) editorSymbolRelease(span->sym[j]);
+        free(span->sym);
+    }
+    free(span);
+}
+
+//let go of chars, whoever they belong to
+void editorRowDropChars(erow *row){
+    if(row->span) editorSpanRelease(row->span);
+    else free(row->chars);
+    row->chars = NULL;
+    row->span = NULL;
+}
+
+//chars without render, for rows that are only being read
+void editorRowChars(erow *row){
+    if(row->chars) return;
+    row->chars = malloc(row->size + 1);
+    if(E.map) memcpy(row->chars, &E.map[row->offset], row->size);
+    else editorPagerCopy(row->chars, row->offset, row->size);
+    row->chars[row->size] = '\0';
+}
+
+//give the row a private copy of chars before writing into it
+void editorRowOwnChars(erow *row){
+    editorRowChars(row);
+    if(row->span == NULL) return;
+    char *chars = malloc(row->size + 1);
+    memcpy(chars, row->chars, row->size + 1);
+    editorRowDropChars(row);
+    row->chars = chars;
+}
+
+//bring in a row that so far only exists as an offset into the mapped file, safe from any thread
+void editorRowLoad(erow *row){
+    if(row->render) return;
+    editorRowChars(row);
+    editorUpdateRender(row);
+}
+
+//rows that can be loaded again from the mapped file or the pager
+int editorRowBacked(erow *row){
+    return row->offset >= 0 && (E.map || E.pager.active);
+}
+
+//drop the contents of a row that can be brought back later
+void editorRowUnload(erow *row){
+    if(!editorRowBacked(row) || row->chars == NULL) return;
+    editorRowDropChars(row);
+    free(row->render);
+    editorRowReleaseHl(row);
+    row->chars = NULL;
+    row->render = NULL;
+}
+
+void editorUpdateRow(erow *row){
+    row->offset = -1; //contents no longer match the file
+    row->wraps = 0;
+    editorUpdateRender(row);
+
+    if(row->idx > E.hlFrontier){ //the frontier gets to it later, with the right entry state
+        editorRowReleaseHl(row);
+        row->brKnown = 0;
+        bracketIndexUpdate(row);
+        editorRowSetSymbol(row, NULL);
+    } else {
+        uint64_t start = perfNow();
+        editorUpdateSyntax(row);
+        perfAddSpan(PERF_SYNTAX, start);
+    }
+
+    if(E.wrapcols != E.screencols) E.wrap.stale = 1;
+    rowIndexUpdate(&E.wrap, row);
+    rowIndexUpdate(&E.bytes, row);
+}
+
+//a row of its own holding a copy of s, rendered and highlighted by editorUpdateRow
+void editorRowInit(erow *row, int at, char *s, size_t len){
+    row->idx = at;
+    row->size = len;
+    row->chars = malloc(len + 1);
+    memcpy(row->chars,s,len);
+    row->chars[len] = '\0';
+    row->render = NULL;
+    row->rsize = 0;
+    row->rcols = 0;
+    row->wraps = 0;
+    row->hl = NULL;
+    row->hlOpenComment = 0;
+    row->hlShared = NULL;
+    row->brKnown = 0;
+    row->sym = NULL;
+    row->span = NULL;
+    row->offset = -1;
+    row->eol = 1;
+}
+
+void editorInsertRow(int at,char *s, size_t len){
+    if(at < 0 || at > E.numrows) return;
+    if(at < E.numrows){ //appending is cheap to account for, see below
+        rowIndexShifted(&E.wrap, at);
+        rowIndexShifted(&E.bytes, at);
+        E.brackets.stale = 1;
+    }
+
+    if(E.numrows == E.rowcap){
+        E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+    }
+    memmove(&E.row[at+1], &E.row[at], sizeof(erow)*(E.numrows - at));
+    for(int j=at+1; j<=E.numrows;j++) E.row[j].idx++;
+    symbolIndexShift(at, 1); //before the new row's own definition goes in
+
+    editorRowInit(&E.row[at], at, s, len);
+    E.row[at].hlOpenComment = at > 0 ? E.row[at-1].hlOpenComment : 0; //what the rows below were highlighted after, so a change reaches them
+    if(at <= E.hlFrontier) E.hlFrontier++;
     E.numrows++;
+    editorUpdateRow(&E.row[at]);
+    bracketIndexAppend();
+    editorFoldShift(at, 1);
     E.dirty++;
+    if(at == E.numrows-1){
+        rowIndexAppend(&E.wrap);
+        rowIndexAppend(&E.bytes);
+    }
 }
 
 void editorRowInsertChar(erow *row, int at, int c){
+    editorRowLoad(row);
+    editorRowOwnChars(row);
     if(at < 0 || at > row->size) at = row->size;
     row->chars = realloc(row->chars, row->size + 2);
     memmove(&row->chars[at+1], &row->chars[at],row->size - at + 1);
@@ -493,6 +2039,10 @@ void editorRowInsertChar(erow *row, int at, int c){
 }
 
 void editorInsertNewLine(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
     if(E.cx == 0){
         editorInsertRow(E.cy, "", 0);
         E.cy++;
@@ -500,8 +2050,10 @@ void editorInsertNewLine(){
         return;
     }
     erow *row = &E.row[E.cy];
+    editorRowLoad(row);
     editorInsertRow(E.cy+1, &row->chars[E.cx], row->size - E.cx);
     row = &E.row[E.cy];
+    editorRowOwnChars(row);
     row->size = E.cx;
     row->chars[row->size] = '\0';
     editorUpdateRow(row);
@@ -509,88 +2061,2388 @@ void editorInsertNewLine(){
     E.cx = 0;
 }
 
+//removes the whole utf-8 sequence starting at at
 void editorRowDelChar(erow *row, int at){
     if(at < 0 || at >= row->size) return;
-    memmove(&row->chars[at], &row->chars[at +1],row->size - at);
-    row->size--;
+    editorRowLoad(row);
+    editorRowOwnChars(row);
+    int n = 1;
+    while(at+n < row->size && utf8IsCont(row->chars[at+n])) n++;
+    memmove(&row->chars[at], &row->chars[at +n],row->size - at - n + 1);
+    row->size -= n;
     editorUpdateRow(row);
     E.dirty++;
 }
 
-void editorFreeRow(erow *row){
-    free(row->chars);
-    free(row->render);
-    free(row->hl);
+void editorFreeRow(erow *row){
+    editorRowDropChars(row);
+    free(row->render);
+    editorRowReleaseHl(row);
+    editorSymbolRelease(row->sym);
+}
+
+void editorDelRow(int at){
+    if(at < 0 || at >= E.numrows) return;
+    int inComment = E.row[at].hlOpenComment; //what the row after it was highlighted after
+    editorFreeRow(&E.row[at]);
+    rowIndexShifted(&E.wrap, at);
+    rowIndexShifted(&E.bytes, at);
+    bracketIndexRemoved(at, 1);
+    memmove(&E.row[at],&E.row[at +1],sizeof(erow) * (E.numrows-at-1));
+    for(int j=at; j<E.numrows-1;j++) E.row[j].idx--;
+    if(at < E.hlFrontier) E.hlFrontier--;
+    E.numrows--;
+    editorFoldShift(at, -1);
+    symbolIndexShift(at, -1);
+    if(at < E.numrows && at < E.hlFrontier && inComment != (at > 0 && E.row[at-1].hlOpenComment)) editorUpdateSyntax(&E.row[at]);
+    E.dirty++;
+}
+
+//room for n more rows
+void editorRowsReserve(int n){
+    if(E.numrows + n > E.rowcap){
+        while(E.numrows + n > E.rowcap) E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+    }
+}
+
+//make room for n rows at at in one move, they are left for the caller to fill in
+void editorOpenRows(int at, int n){
+    editorRowsReserve(n);
+    memmove(&E.row[at+n], &E.row[at], sizeof(erow) * (E.numrows - at));
+    for(int j=at+n;j<E.numrows+n;j++) E.row[j].idx += n;
+    memset(&E.row[at], 0, sizeof(erow) * n);
+    for(int j=at;j<at+n;j++){
+        E.row[j].idx = j;
+        E.row[j].eol = 1;
+    }
+    E.numrows += n;
+    rowIndexShifted(&E.wrap, at);
+    rowIndexShifted(&E.bytes, at);
+    E.brackets.stale = 1;
+    if(at < E.hlFrontier) E.hlFrontier = at; //entry states after here are not known anymore
+    editorScheduleJob(editorHighlightJob);
+    editorFoldShift(at, n);
+    symbolIndexShift(at, n);
+    E.dirty++;
+}
+
+//delete n rows from at on in one move
+void editorDelRows(int at, int n){
+    for(int j=at;j<at+n;j++) editorFreeRow(&E.row[j]);
+    memmove(&E.row[at], &E.row[at+n], sizeof(erow) * (E.numrows - at - n));
+    E.numrows -= n;
+    for(int j=at;j<E.numrows;j++) E.row[j].idx -= n;
+    rowIndexShifted(&E.wrap, at);
+    rowIndexShifted(&E.bytes, at);
+    bracketIndexRemoved(at, n);
+    if(at < E.hlFrontier) E.hlFrontier = at;
+    editorScheduleJob(editorHighlightJob);
+    editorFoldShift(at, -n);
+    symbolIndexShift(at, -n);
+    E.dirty++;
+}
+
+//everything kept by row number follows a batch of inserted and deleted rows, once the rows themselves moved
+void editorRowsShifted(const struct rowShift *s, int n){
+    if(n == 0) return;
+    int gone;
+    rowIndexShifted(&E.wrap, s[0].at);
+    rowIndexShifted(&E.bytes, s[0].at);
+    E.brackets.stale = 1;
+    E.hlFrontier = rowShiftMap(s, n, E.hlFrontier, &gone);
+    if(E.brackets.pending != INT_MAX) E.brackets.pending = rowShiftMap(s, n, E.brackets.pending, &gone);
+    editorFoldRemap(s, n);
+    symbolIndexRemap(s, n);
+    E.dirty++;
+}
+
+void editorRowAppendString(erow *row, char *s, int len){
+    editorRowLoad(row);
+    editorRowOwnChars(row);
+    row->chars = realloc(row->chars,row->size + len +1);
+    memcpy(&row->chars[row->size],s,len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    E.dirty++;    
+}
+
+/*** brackets ***/
+
+//+1 for an opening bracket at render[at], -1 for a closing one, brackets inside strings and comments do not count
+int editorBracketAt(char *render, unsigned char *hl, int at){
+    if(hl[at] == HL_STRING || hl[at] == HL_COMMENT || hl[at] == HL_MLCOMMENT) return 0;
+    switch(render[at]){
+        case '(': case '[': case '{': return 1;
+        case ')': case ']': case '}': return -1;
+    }
+    return 0;
+}
+
+//depth change across a line and the lowest depth reached in it, both relative to where it starts
+void editorBracketCount(char *render, unsigned char *hl, int len, int *delta, int *min){
+    int depth = 0, lowest = 0;
+    for(int j=0;j<len;j++){
+        depth += editorBracketAt(render, hl, j);
+        if(depth < lowest) lowest = depth;
+    }
+    *delta = depth;
+    *min = lowest;
+}
+
+//rows that were never counted weigh nothing, searches that end up past what is known check again
+void bracketIndexLeaf(int at){
+    struct bracketNode *leaf = &E.brackets.tree[E.brackets.size + at];
+    erow *row = &E.row[at];
+    leaf->sum = row->brKnown ? row->brDelta : 0;
+    leaf->min = row->brKnown ? row->brMin : 0;
+}
+
+void bracketIndexJoin(int node){
+    struct bracketNode *tree = E.brackets.tree;
+    struct bracketNode *l = &tree[2*node], *r = &tree[2*node+1];
+    tree[node].sum = l->sum + r->sum;
+    tree[node].min = l->min < l->sum + r->min ? l->min : l->sum + r->min;
+}
+
+void bracketIndexBuild(){
+    struct bracketIndex *ix = &E.brackets;
+    int size = 1;
+    while(size < E.numrows) size *= 2;
+    if(size != ix->size || ix->tree == NULL){
+        ix->size = size;
+        ix->tree = realloc(ix->tree, sizeof(struct bracketNode) * 2 * size);
+    }
+    ix->n = E.numrows;
+    ix->stale = 0;
+    for(int i=0;i<E.numrows;i++) bracketIndexLeaf(i);
+    memset(&ix->tree[size + E.numrows], 0, sizeof(struct bracketNode) * (size - E.numrows));
+    for(int node=size-1;node>0;node--) bracketIndexJoin(node);
+}
+
+void bracketIndexEnsure(){
+    if(E.brackets.stale || E.brackets.tree == NULL || E.brackets.n != E.numrows) bracketIndexBuild();
+}
+
+//bring one row's counts up to date without rebuilding
+void bracketIndexUpdate(erow *row){
+    struct bracketIndex *ix = &E.brackets;
+    if(ix->tree == NULL || ix->stale || row->idx >= ix->n) return;
+    bracketIndexLeaf(row->idx);
+    for(int node=(ix->size + row->idx)/2;node>0;node /= 2) bracketIndexJoin(node);
+}
+
+//account for a row just added at the end while there is room for it
+void bracketIndexAppend(){
+    struct bracketIndex *ix = &E.brackets;
+    if(ix->tree == NULL || ix->stale || ix->n != E.numrows-1 || ix->n == ix->size){
+        ix->stale = 1;
+        return;
+    }
+    ix->n++;
+    bracketIndexUpdate(&E.row[ix->n-1]);
+}
+
+//rows from at on moved up by n, the counted ones before pending stay counted
+void bracketIndexRemoved(int at, int n){
+    E.brackets.stale = 1;
+    if(E.brackets.pending > at) E.brackets.pending = E.brackets.pending - n > at ? E.brackets.pending - n : at;
+}
+
+//depth before row at
+int bracketIndexPrefix(int at){
+    struct bracketIndex *ix = &E.brackets;
+    if(at >= ix->size) return ix->tree[1].sum;
+    int sum = 0;
+    for(int node=ix->size + at;node>1;node /= 2){
+        if(node & 1) sum += ix->tree[node-1].sum; //everything in the left sibling comes first
+    }
+    return sum;
+}
+
+//first row from on where the depth falls below depth, node covers rows [lo, hi) and base is the depth before lo
+int bracketIndexFirst(int node, int lo, int hi, int from, int base, int depth){
+    if(hi <= from || lo >= E.brackets.n) return -1;
+    if(lo >= from && base + E.brackets.tree[node].min >= depth) return -1;
+    if(hi - lo == 1) return lo;
+    int mid = (lo + hi) / 2;
+    int found = bracketIndexFirst(2*node, lo, mid, from, base, depth);
+    if(found != -1) return found;
+    return bracketIndexFirst(2*node+1, mid, hi, from, base + E.brackets.tree[2*node].sum, depth);
+}
+
+//last row before before where the depth falls below depth
+int bracketIndexLast(int node, int lo, int hi, int before, int base, int depth){
+    if(lo >= before) return -1;
+    if(hi <= before && base + E.brackets.tree[node].min >= depth) return -1;
+    if(hi - lo == 1) return lo;
+    int mid = (lo + hi) / 2;
+    int found = bracketIndexLast(2*node+1, mid, hi, before, base + E.brackets.tree[2*node].sum, depth);
+    if(found != -1) return found;
+    return bracketIndexLast(2*node, lo, mid, before, base, depth);
+}
+
+//rows before this one have bracket counts that can be trusted
+int editorBracketsKnown(){
+    return E.brackets.pending < E.hlFrontier ? E.brackets.pending : E.hlFrontier;
+}
+
+//count the row at pending if that never happened, rows only loaded for it are let go again
+void editorBracketCheck(){
+    erow *row = &E.row[E.brackets.pending++];
+    if(row->brKnown) return;
+    int lazy = (row->render == NULL);
+    editorUpdateSyntax(row);
+    if(lazy) editorRowUnload(row);
+}
+
+void editorBracketExtend(int upto){
+    if(upto > E.numrows) upto = E.numrows;
+    editorHighlightUpTo(upto);
+    while(E.brackets.pending < upto) editorBracketCheck();
+}
+
+//counts the rows a line index open left uncounted, the pager keeps its place for rows still streaming in
+int editorBracketJob(uint64_t deadline){
+    int upto = E.numrows < E.hlFrontier ? E.numrows : E.hlFrontier;
+    while(E.brackets.pending < upto){
+        editorBracketCheck();
+        if((E.brackets.pending & 63) == 0 && perfNow() >= deadline) break;
+    }
+    if(E.brackets.pending >= E.numrows && !E.pager.active) E.brackets.pending = INT_MAX;
+    return E.brackets.pending < upto;
+}
+
+erow *editorBracketRow(int at){
+    erow *row = &E.row[at];
+    editorRowLoad(row);
+    if(row->hl == NULL) editorUpdateSyntax(row);
+    return row;
+}
+
+/*
+find where the depth falls below the one before render[at] of filerow plus rel, going forward from at or back from just before it
+the rows in between are skipped through the index, only the two ends get scanned
+rows past the highlight frontier get highlighted when extend is set, otherwise a bracket out there counts as not found
+*/
+int editorBracketFind(int filerow, int at, int rel, int dir, int extend, int *mrow, int *mat){
+    if(filerow >= editorBracketsKnown()){
+        if(!extend) return 0;
+        editorBracketExtend(filerow+1);
+    }
+    bracketIndexEnsure();
+    erow *row = editorBracketRow(filerow);
+    int depth = bracketIndexPrefix(filerow);
+    for(int j=0;j<at;j++) depth += editorBracketAt(row->render, row->hl, j);
+    int cur = depth;
+    depth += rel;
+
+    if(dir < 0){
+        for(int j=at-1;j>=0;j--){
+            cur -= editorBracketAt(row->render, row->hl, j);
+            if(cur < depth){
+                *mrow = filerow;
+                *mat = j;
+                return 1;
+            }
+        }
+        int r = bracketIndexLast(1, 0, E.brackets.size, filerow, 0, depth);
+        if(r == -1) return 0;
+        row = editorBracketRow(r);
+        cur = bracketIndexPrefix(r+1);
+        for(int j=row->rsize-1;j>=0;j--){
+            cur -= editorBracketAt(row->render, row->hl, j);
+            if(cur < depth){
+                *mrow = r;
+                *mat = j;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    for(int j=at;j<row->rsize;j++){
+        cur += editorBracketAt(row->render, row->hl, j);
+        if(cur < depth){
+            *mrow = filerow;
+            *mat = j;
+            return 1;
+        }
+    }
+    while(1){
+        int r = bracketIndexFirst(1, 0, E.brackets.size, filerow+1, 0, depth);
+        int known = editorBracketsKnown();
+        if(r == -1 || r >= known){ //rows not counted yet may hold it, or move it
+            if(!extend || known >= E.numrows) return 0;
+            editorBracketExtend(r == -1 ? E.numrows : r+1);
+            continue;
+        }
+        row = editorBracketRow(r);
+        cur = bracketIndexPrefix(r);
+        for(int j=0;j<row->rsize;j++){
+            cur += editorBracketAt(row->render, row->hl, j);
+            if(cur < depth){
+                *mrow = r;
+                *mat = j;
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
+
+//the bracket under the cursor and its match, or else the closest pair around the cursor
+void editorBracketPair(int extend, struct bracketPair *pair){
+    pair->row0 = pair->at0 = pair->row1 = pair->at1 = -1;
+    if(E.cy >= E.numrows) return;
+    if(E.cy >= editorBracketsKnown()){
+        if(!extend) return;
+        editorBracketExtend(E.cy+1);
+    }
+    erow *row = editorBracketRow(E.cy);
+    int at = editorRowCxToRender(row, E.cx);
+    int type = at < row->rsize ? editorBracketAt(row->render, row->hl, at) : 0;
+
+    if(type > 0){
+        pair->row0 = E.cy;
+        pair->at0 = at;
+        if(!editorBracketFind(E.cy, at, 1, 1, extend, &pair->row1, &pair->at1)) pair->row1 = -1;
+    } else if(type < 0){
+        pair->row1 = E.cy;
+        pair->at1 = at;
+        if(!editorBracketFind(E.cy, at+1, 1, -1, extend, &pair->row0, &pair->at0)) pair->row0 = -1;
+    } else {
+        if(!editorBracketFind(E.cy, at, 0, -1, extend, &pair->row0, &pair->at0)) pair->row0 = -1;
+        if(!editorBracketFind(E.cy, at, 0, 1, extend, &pair->row1, &pair->at1)) pair->row1 = -1;
+    }
+}
+
+//jump to the bracket matching the one under the cursor, or out to the one that opens the block the cursor is in
+void editorBracketJump(){
+    struct bracketPair pair;
+    editorBracketPair(1, &pair);
+    int row = pair.row0, at = pair.at0;
+    if(pair.row0 == E.cy && pair.at0 == editorRowCxToRender(&E.row[E.cy], E.cx)){
+        row = pair.row1;
+        at = pair.at1;
+    }
+    if(row == -1){
+        editorSetStatusMessage("No matching bracket");
+        return;
+    }
+    if(pair.row0 != -1 && pair.row1 != -1){
+        char open = E.row[pair.row0].render[pair.at0], close = E.row[pair.row1].render[pair.at1];
+        if(!((open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}'))){
+            editorSetStatusMessage("Mismatched %c and %c", open, close);
+        }
+    }
+    E.cy = row;
+    E.cx = editorRowRxToCx(&E.row[row], editorRenderByteToCol(&E.row[row], at));
+}
+
+/*** symbols ***/
+
+void editorSymbolRelease(struct symbol *sym){
+    if(sym && --sym->refs == 0) free(sym);
+}
+
+int editorSymbolChar(int c){
+    return isalnum(c) || c == '_';
+}
+
+//bit for a character of a name, case does not matter to a search
+uint32_t editorSymbolBit(int c){
+    c = tolower(c);
+    if(c >= 'a' && c <= 'z') return 1u << (c - 'a');
+    if(c == '_') return 1u << 26;
+    if(isdigit(c)) return 1u << 27;
+    return 1u << 28;
+}
+
+struct symbol *editorSymbolNew(int kind, char *name, int at, int len){
+    struct symbol *sym = malloc(sizeof(*sym) + len + 1);
+    sym->refs = 1;
+    sym->kind = kind;
+    sym->at = at;
+    sym->len = len;
+    sym->mask = 0;
+    for(int j=0;j<len;j++) sym->mask |= editorSymbolBit((unsigned char)name[j]);
+    memcpy(sym->name, name, len);
+    sym->name[len] = '\0';
+    return sym;
+}
+
+int editorSymbolCode(unsigned char hl){
+    return hl != HL_STRING && hl != HL_COMMENT && hl != HL_MLCOMMENT;
+}
+
+int editorSymbolIsWord(char *render, int at, int end, const char *word){
+    int len = strlen(word);
+    return end - at == len && !strncmp(&render[at], word, len);
+}
+
+/*
+what a line defines going by its highlight, so nothing inside strings or comments counts
+struct, union and enum followed by a name and a brace or nothing else, typedefs ending on the line,
+and at the start of a line a name followed by ( with only types before it and no ; at the end
+*/
+struct symbol *editorSymbolParse(char *render, unsigned char *hl, int len){
+    int end = len;
+    while(end > 0 && (isspace((unsigned char)render[end-1]) || hl[end-1] == HL_COMMENT || hl[end-1] == HL_MLCOMMENT)) end--;
+    int i = 0;
+    while(i < end && isspace((unsigned char)render[i])) i++;
+    if(i == end || !editorSymbolChar((unsigned char)render[i]) || !editorSymbolCode(hl[i])) return NULL;
+    int indented = (i > 0);
+
+    int w = i;
+    while(w < end && editorSymbolChar((unsigned char)render[w])) w++;
+
+    if(editorSymbolIsWord(render, i, w, "typedef")){
+        char *brace = memchr(&render[w], '{', end - w);
+        if(brace){ //typedef struct name {, the name after the closing brace is on some later line
+            while(w < end && isspace((unsigned char)render[w])) w++;
+            i = w;
+            while(w < end && editorSymbolChar((unsigned char)render[w])) w++;
+            int kind = editorSymbolIsWord(render, i, w, "struct") ? SYM_STRUCT :
+                editorSymbolIsWord(render, i, w, "union") ? SYM_UNION :
+                editorSymbolIsWord(render, i, w, "enum") ? SYM_ENUM : -1;
+            if(kind == -1) return NULL;
+            while(w < end && isspace((unsigned char)render[w])) w++;
+            i = w;
+            while(w < end && editorSymbolChar((unsigned char)render[w])) w++;
+            return w > i && hl[i] == HL_NORMAL ? editorSymbolNew(kind, &render[i], i, w - i) : NULL;
+        }
+        if(render[end-1] != ';') return NULL;
+        //a function pointer type is named inside (*name), anything else by its last word
+        char *paren = memchr(&render[w], '(', end - w);
+        int e = end-1;
+        if(paren){
+            i = paren - render + 1;
+            while(i < end && (isspace((unsigned char)render[i]) || render[i] == '*')) i++;
+            e = i;
+            while(e < end && editorSymbolChar((unsigned char)render[e])) e++;
+        } else {
+            while(e > w && (isspace((unsigned char)render[e-1]) || render[e-1] == ']')){
+                if(render[e-1] == ']') while(e > w && render[e-1] != '[') e--;
+                e--;
+            }
+            i = e;
+            while(i > w && editorSymbolChar((unsigned char)render[i-1])) i--;
+        }
+        return e > i && hl[i] == HL_NORMAL && !isdigit((unsigned char)render[i]) ? editorSymbolNew(SYM_TYPEDEF, &render[i], i, e - i) : NULL;
+    }
+
+    int first = i, firstEnd = w; //static struct name ... is still a struct
+    if(editorSymbolIsWord(render, i, w, "static")){
+        while(w < end && isspace((unsigned char)render[w])) w++;
+        first = w;
+        while(w < end && editorSymbolChar((unsigned char)render[w])) w++;
+        firstEnd = w;
+    }
+    int kind = editorSymbolIsWord(render, first, firstEnd, "struct") ? SYM_STRUCT :
+        editorSymbolIsWord(render, first, firstEnd, "union") ? SYM_UNION :
+        editorSymbolIsWord(render, first, firstEnd, "enum") ? SYM_ENUM : -1;
+    if(kind != -1){
+        while(w < end && isspace((unsigned char)render[w])) w++;
+        int n = w;
+        while(w < end && editorSymbolChar((unsigned char)render[w])) w++;
+        int e = w;
+        while(w < end && isspace((unsigned char)render[w])) w++;
+        if(e > n && hl[n] == HL_NORMAL && (w == end || render[w] == '{')) return editorSymbolNew(kind, &render[n], n, e - n);
+    }
+    if(indented || render[end-1] == ';') return NULL;
+
+    //function definitions, the name is the word right before the first (
+    int paren = 0;
+    while(paren < end && render[paren] != '('){
+        char c = render[paren];
+        if(!editorSymbolCode(hl[paren]) || (!editorSymbolChar((unsigned char)c) && !isspace((unsigned char)c) && c != '*')) return NULL;
+        paren++;
+    }
+    if(paren == end) return NULL;
+    int e = paren;
+    while(e > 0 && isspace((unsigned char)render[e-1])) e--;
+    int n = e;
+    while(n > 0 && editorSymbolChar((unsigned char)render[n-1])) n--;
+    if(n == e || isdigit((unsigned char)render[n]) || hl[n] != HL_NORMAL) return NULL;
+    //words before it must be types, not return or else
+    for(int j=0;j<n;){
+        if(!editorSymbolChar((unsigned char)render[j])){
+            j++;
+            continue;
+        }
+        int k = j;
+        while(k < n && editorSymbolChar((unsigned char)render[k])) k++;
+        if(hl[j] == HL_KEYWORD1 && !editorSymbolIsWord(render, j, k, "static") && !editorSymbolIsWord(render, j, k, "struct")
+            && !editorSymbolIsWord(render, j, k, "union") && !editorSymbolIsWord(render, j, k, "enum")) return NULL;
+        j = k;
+    }
+    return editorSymbolNew(SYM_FUNCTION, &render[n], n, e - n);
+}
+
+//entry i of the index in row order, wherever the gap is
+struct symbolRef *symbolIndexAt(int i){
+    struct symbolIndex *ix = &E.symbols;
+    return &ix->all[i < ix->gap ? i : i + ix->cap - ix->count];
+}
+
+void symbolIndexMoveGap(int to){
+    struct symbolIndex *ix = &E.symbols;
+    int gaplen = ix->cap - ix->count;
+    if(to < ix->gap) memmove(&ix->all[to + gaplen], &ix->all[to], sizeof(struct symbolRef) * (ix->gap - to));
+    else if(to > ix->gap) memmove(&ix->all[ix->gap], &ix->all[ix->gap + gaplen], sizeof(struct symbolRef) * (to - ix->gap));
+    ix->gap = to;
+}
+
+//first entry at or after row, right at the gap when the last change was just before it
+int symbolIndexSearch(int row){
+    struct symbolIndex *ix = &E.symbols;
+    if((ix->gap == 0 || symbolIndexAt(ix->gap-1)->row < row) && (ix->gap == ix->count || symbolIndexAt(ix->gap)->row >= row)) return ix->gap;
+    int lo = 0, hi = ix->count;
+    while(lo < hi){
+        int mid = lo + (hi-lo)/2;
+        if(symbolIndexAt(mid)->row < row) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+a search copy of the name is a 16 byte header with the bits of its word starts and its length,
+followed by its first 64 characters in lowercase zero padded to whole 16 byte blocks,
+laid out one after another so a search reads them in order
+*/
+#define SYMBOL_NAME_HEADER 16
+size_t symbolNameSize(int len){
+    return SYMBOL_NAME_HEADER + (((len < 64 ? len : 64) + 15) & ~15);
+}
+
+int symbolNameLen(uint32_t name){
+    int len;
+    memcpy(&len, &E.symbols.names[name + sizeof(uint64_t)], sizeof(len));
+    return len;
+}
+
+uint64_t symbolKey(uint32_t mask, uint32_t initials, int len){
+    return (uint64_t)mask | (uint64_t)initials << 29 | (uint64_t)(len < 63 ? len : 63) << 58;
+}
+
+//fills in everything about sym in r but its row
+void symbolIndexFill(struct symbolRef *r, struct symbol *sym){
+    struct symbolIndex *ix = &E.symbols;
+    size_t size = symbolNameSize(sym->len);
+    if(ix->nameBytes + size > ix->nameCap){
+        ix->nameCap = ix->nameCap ? ix->nameCap * 2 : 65536;
+        ix->names = realloc(ix->names, ix->nameCap);
+    }
+    char *p = &ix->names[ix->nameBytes];
+    uint64_t starts = 0;
+    uint32_t initials = 0;
+    memset(p, 0, size);
+    for(int j=0;j<sym->len && j<64;j++){
+        unsigned char c = sym->name[j], before = j > 0 ? sym->name[j-1] : '_';
+        if(before == '_' || (islower(before) && isupper(c)) || (isdigit(c) && !isdigit(before))){
+            starts |= 1ull << j;
+            initials |= editorSymbolBit(c);
+        }
+        p[SYMBOL_NAME_HEADER + j] = tolower(c);
+    }
+    memcpy(p, &starts, sizeof(starts));
+    memcpy(p + sizeof(starts), &sym->len, sizeof(sym->len));
+    r->name = p - ix->names;
+    r->key = symbolKey(sym->mask, initials, sym->len);
+    ix->nameBytes += size;
+}
+
+//copy the names entries still use to a new buffer, in entry order
+void symbolIndexCompact(){
+    struct symbolIndex *ix = &E.symbols;
+    size_t bytes = ix->nameBytes - ix->nameDead;
+    char *names = malloc(bytes ? bytes : 1);
+    size_t used = 0;
+    for(int j=0;j<ix->cap;j++){
+        if(j >= ix->gap && j < ix->gap + ix->cap - ix->count) continue;
+        struct symbolRef *r = &ix->all[j];
+        size_t size = symbolNameSize(symbolNameLen(r->name));
+        memcpy(&names[used], &ix->names[r->name], size);
+        r->name = used;
+        used += size;
+    }
+    free(ix->names);
+    ix->names = names;
+    ix->nameBytes = ix->nameCap = used;
+    ix->nameDead = 0;
+}
+
+void symbolIndexDropName(struct symbolRef *r){
+    struct symbolIndex *ix = &E.symbols;
+    ix->nameDead += symbolNameSize(symbolNameLen(r->name));
+}
+
+void symbolIndexCheckNames(){
+    struct symbolIndex *ix = &E.symbols;
+    if(ix->nameDead > 65536 && ix->nameDead > ix->nameBytes / 2) symbolIndexCompact();
+}
+
+//make the entry of row point at sym, NULL takes it out
+void symbolIndexSet(int row, struct symbol *sym){
+    struct symbolIndex *ix = &E.symbols;
+    int i = symbolIndexSearch(row);
+    int found = (i < ix->count && symbolIndexAt(i)->row == row);
+    if(found && sym){
+        struct symbolRef *r = symbolIndexAt(i);
+        symbolIndexDropName(r);
+        symbolIndexFill(r, sym);
+    } else if(found){
+        symbolIndexDropName(symbolIndexAt(i));
+        symbolIndexMoveGap(i);
+        ix->count--; //the entry right after the gap becomes part of it
+    } else if(sym){
+        if(ix->count == ix->cap){ //grow, the entries after the gap move to the new end
+            int cap = ix->cap ? ix->cap * 2 : 256;
+            int tail = ix->count - ix->gap;
+            ix->all = realloc(ix->all, sizeof(struct symbolRef) * cap);
+            memmove(&ix->all[cap - tail], &ix->all[ix->cap - tail], sizeof(struct symbolRef) * tail);
+            ix->cap = cap;
+        }
+        symbolIndexMoveGap(i);
+        struct symbolRef *r = &ix->all[ix->gap];
+        r->row = row;
+        symbolIndexFill(r, sym);
+        ix->gap++;
+        ix->count++;
+    } else {
+        return;
+    }
+    symbolIndexCheckNames();
+    ix->version++;
+}
+
+//keep entries on their rows through a batch of inserted and deleted rows, entries on deleted rows go
+void symbolIndexRemap(const struct rowShift *s, int n){
+    struct symbolIndex *ix = &E.symbols;
+    if(n == 0) return;
+    int lo = symbolIndexSearch(s[0].at);
+    if(lo == ix->count) return;
+    symbolIndexMoveGap(lo);
+    //everything affected is after the gap, going from the end lets the kept ones close up in the same pass
+    int tail = ix->gap + ix->cap - ix->count, w = ix->cap;
+    for(int j=ix->cap-1;j>=tail;j--){
+        int gone;
+        struct symbolRef r = ix->all[j];
+        r.row = rowShiftMap(s, n, r.row, &gone);
+        if(gone){
+            symbolIndexDropName(&ix->all[j]);
+            continue;
+        }
+        ix->all[--w] = r;
+    }
+    ix->count -= w - tail;
+    symbolIndexCheckNames();
+    ix->version++;
+}
+
+//delta rows inserted at at, or -delta rows from at on deleted
+void symbolIndexShift(int at, int delta){
+    struct rowShift s = { at, delta, 0 };
+    symbolIndexRemap(&s, 1);
+}
+
+void editorRowSetSymbol(erow *row, struct symbol *sym){
+    if(row->sym == sym) return;
+    if(sym) sym->refs++;
+    editorSymbolRelease(row->sym);
+    row->sym = sym;
+    symbolIndexSet(row->idx, sym);
+}
+
+char *symbolKinds[] = { "function", "struct", "union", "enum", "typedef" };
+
+//bit j of pm[q] is set when the lowercase name has query[q] at j, name being a search copy padded to 16 bytes
+void editorSymbolPositions(const char *name, int len, const char *query, int qlen, uint64_t *pm){
+    if(len > 64) len = 64;
+    for(int q=0;q<qlen;q++){
+        uint64_t m = 0;
+#ifdef __SSE2__
+        __m128i c = _mm_set1_epi8(query[q]);
+        for(int k=0;k<len;k+=16){
+            __m128i v = _mm_loadu_si128((const __m128i *)&name[k]);
+            m |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c)) << k;
+        }
+#else
+        for(int k=0;k<len;k++) m |= (uint64_t)(name[k] == query[q]) << k;
+#endif
+        pm[q] = m;
+    }
+}
+
+/*
+how well a query matches a name as a subsequence ignoring case, higher is better, -1 when it does not
+the match is found forward to the earliest place it can end, then scored going back from there taking the latest
+position for each character, which keeps it tight and lands on word starts like the O of editorOpen
+matches at the start of words and runs of matched characters count the most, shorter names win ties
+names only match on their first 64 characters
+*/
+int editorSymbolScore(const uint64_t *pm, int qlen, uint64_t starts, int len){
+    int pos = -1;
+    for(int q=0;q<qlen;q++){
+        uint64_t m = pos < 63 ? pm[q] & (~0ull << (pos+1)) : 0;
+        if(m == 0) return -1;
+        pos = __builtin_ctzll(m);
+    }
+
+    int score = 0, next = pos+1;
+    for(int q=qlen-1;q>=0;q--){
+        uint64_t below = next < 64 ? (1ull << next) - 1 : ~0ull;
+        int j = 63 - __builtin_clzll(pm[q] & below);
+        score += 16;
+        if(q < qlen-1){
+            if(j+1 == next) score += 16;
+            else score -= next-j-1 < 8 ? next-j-1 : 8;
+        }
+        if((starts >> j) & 1) score += 24;
+        next = j;
+    }
+    if(next == 0) score += 16;
+    if(len == qlen) score += 64;
+    return score * 64 - (len < 63 ? len : 63);
+}
+
+int editorSymbolMatchCmp(const void *a, const void *b){
+    const struct symbolMatch *x = a, *y = b;
+    if(x->score != y->score) return y->score - x->score;
+    return x->row - y->row;
+}
+
+//score an entry and keep it if it makes it among the best
+void editorSymbolRankOne(struct symbolRef *r, const char *query, int qlen){
+    struct symbolSearch *s = &symbolSearch;
+    char *name = &E.symbols.names[r->name];
+    uint64_t starts, pm[64];
+    int len = symbolNameLen(r->name);
+    memcpy(&starts, name, sizeof(starts));
+    editorSymbolPositions(name + SYMBOL_NAME_HEADER, len, query, qlen, pm);
+    int score = editorSymbolScore(pm, qlen, starts, len);
+    if(score < 0) return;
+
+    int slot = s->nbest;
+    if(s->nbest == QUILLO_SYMBOL_RESULTS){ //entries come in row order, so ties keep the earlier one
+        if(score <= s->best[s->worst].score) return;
+        slot = s->worst;
+        editorSymbolRelease(s->best[slot].sym);
+    } else {
+        s->nbest++;
+    }
+    s->best[slot].score = score;
+    s->best[slot].row = r->row;
+    s->best[slot].sym = E.row[r->row].sym;
+    s->best[slot].sym->refs++;
+    s->worst = 0;
+    for(int j=1;j<s->nbest;j++){
+        if(editorSymbolMatchCmp(&s->best[j], &s->best[s->worst]) > 0) s->worst = j;
+    }
+}
+
+void editorSymbolForget(){
+    struct symbolSearch *s = &symbolSearch;
+    for(int j=0;j<s->nbest;j++) editorSymbolRelease(s->best[j].sym);
+    s->nbest = 0;
+}
+
+/*
+rank every definition against query, which only takes a look at most of them
+entries missing a character of the query are dropped by their masks, the rest stay candidates and a query that
+only grew starts from those, then a candidate is only scored when the most it could score beats the worst of the
+best so far, which its first character, word start characters and length bound without reading the name
+*/
+void editorSymbolRank(char *query){
+    struct symbolSearch *s = &symbolSearch;
+    struct symbolIndex *ix = &E.symbols;
+    int qlen = strlen(query);
+    char *lower = malloc(qlen + 1);
+    uint32_t mask = 0, bits[64];
+    for(int j=0;j<=qlen;j++) lower[j] = tolower((unsigned char)query[j]);
+    for(int j=0;j<qlen && j<64;j++){
+        bits[j] = editorSymbolBit((unsigned char)lower[j]);
+        mask |= bits[j];
+    }
+
+    //with no character twice in the query, the word starts it can land on are counted by the mask alone
+    int distinct = 1;
+    for(int j=0;j<qlen && j<64;j++){
+        for(int q=0;q<j;q++) if(lower[q] == lower[j]) distinct = 0;
+    }
+
+    //cand holds entry positions, they are where they were while version has not moved
+    //query is only kept for a search that went through the index, names only match on their first 64 characters
+    int searched = (qlen > 0 && qlen <= 64);
+    int narrow = (searched && s->query && s->version == ix->version && !strncmp(lower, s->query, strlen(s->query)));
+    int total = !searched ? 0 : narrow ? s->ncand : ix->count;
+    if(!narrow) s->cand = realloc(s->cand, sizeof(int) * (ix->count ? ix->count : 1));
+    int n = 0, worst = 0;
+    editorSymbolForget();
+    for(int k=0;k<total;k++){
+        int i = narrow ? s->cand[k] : (k < ix->gap ? k : k + ix->cap - ix->count);
+        uint64_t key = ix->all[i].key;
+        int len = key >> 58;
+        if((key & mask) != mask || (len < qlen && len < 63)) continue;
+        s->cand[n++] = i;
+        if(s->nbest == QUILLO_SYMBOL_RESULTS){ //see editorSymbolScore for what each part stands for
+            uint32_t initials = key >> 29;
+            int hits = 0;
+            if(distinct){
+                hits = __builtin_popcount(initials & mask);
+            } else {
+                for(int q=0;q<qlen;q++) if(initials & bits[q]) hits++;
+            }
+            //a name starts with a word, so only one starting with a word start character can match at 0
+            int bound = 32*qlen - 16 + 24*hits + (initials & bits[0] ? 16 : 0) + (len == qlen || (len == 63 && qlen >= 63) ? 64 : 0);
+            if(bound * 64 - len <= worst) continue;
+        }
+        editorSymbolRankOne(&ix->all[i], lower, qlen);
+        if(s->nbest == QUILLO_SYMBOL_RESULTS) worst = s->best[s->worst].score;
+    }
+    s->ncand = n;
+    qsort(s->best, s->nbest, sizeof(struct symbolMatch), editorSymbolMatchCmp);
+
+    free(s->query);
+    s->query = searched ? lower : NULL;
+    if(!searched) free(lower);
+    s->version = ix->version;
+    s->current = 0;
+}
+
+void editorSymbolCallback(char *query, int key){
+    struct symbolSearch *s = &symbolSearch;
+    switch(key){
+        case '\r':
+        case '\x1b':
+            editorSymbolForget();
+            free(s->query);
+            free(s->cand);
+            s->query = NULL;
+            s->cand = NULL;
+            return;
+        case ARROW_DOWN:
+        case ARROW_RIGHT:
+            if(s->nbest) s->current = (s->current + 1) % s->nbest;
+            break;
+        case ARROW_UP:
+        case ARROW_LEFT:
+            if(s->nbest) s->current = (s->current + s->nbest - 1) % s->nbest;
+            break;
+        default:
+            editorSymbolRank(query);
+    }
+
+    //the prompt is a format for editorPrompt, names never hold a %
+    int known = editorBracketsKnown();
+    int n = snprintf(s->prompt, sizeof(s->prompt), "Symbol: %%s");
+    if(known < E.numrows) n += snprintf(&s->prompt[n], sizeof(s->prompt) - n, " (indexed %d%%%%)", (int)((int64_t)known * 100 / E.numrows));
+    if(s->nbest == 0){
+        if(query[0]) snprintf(&s->prompt[n], sizeof(s->prompt) - n, "  no match");
+        return;
+    }
+    struct symbolMatch *m = &s->best[s->current];
+    snprintf(&s->prompt[n], sizeof(s->prompt) - n, "  %d/%d %s %s", s->current+1, s->nbest, symbolKinds[m->sym->kind], m->sym->name);
+    if(m->row >= E.numrows) return;
+
+    erow *row = &E.row[m->row];
+    editorRowLoad(row);
+    E.cy = m->row;
+    E.cx = editorRowRxToCx(row, editorRenderByteToCol(row, m->sym->at));
+    E.rowoffset = E.numrows;
+    E.wrapoffset = 0;
+}
+
+//fuzzy search the definitions in the buffer, the best match is shown while typing and arrows go through the rest
+void editorSymbolJump(){
+    if(E.syntax == NULL || !(E.syntax->flags & HL_INDEX_SYMBOLS)){
+        editorSetStatusMessage("No symbols for this file type");
+        return;
+    }
+    int savedcx = E.cx;
+    int savedcy = E.cy;
+    int savedcoloff = E.coloffset;
+    int savedrowoff = E.rowoffset;
+    int savedwrapoff = E.wrapoffset;
+
+    snprintf(symbolSearch.prompt, sizeof(symbolSearch.prompt), "Symbol: %%s");
+    char *query = editorPrompt(symbolSearch.prompt, editorSymbolCallback);
+
+    if(query){
+        free(query);
+        return;
+    }
+    E.cx = savedcx;
+    E.cy = savedcy;
+    E.coloffset = savedcoloff;
+    E.rowoffset = savedrowoff;
+    E.wrapoffset = savedwrapoff;
+}
+
+/*** editor operations ***/
+
+void editorInsertChar(int c){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    if(E.cy == E.numrows){
+        editorInsertRow(E.numrows,"",0);
+    }
+    editorRowInsertChar(&E.row[E.cy],E.cx,c);
+    E.cx++;
+}
+
+void editorDelChar(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    if(E.cy == E.numrows) return;
+    if(E.cx == 0 && E.cy == 0) return;
+
+    erow *row = &E.row[E.cy];
+
+    if(E.cx > 0){
+        editorRowLoad(row);
+        int at = E.cx-1;
+        while(at > 0 && utf8IsCont(row->chars[at])) at--;
+        editorRowDelChar(row, at);
+        E.cx = at;
+        return;
+    }
+    E.cx = E.row[E.cy-1].size;
+    editorRowLoad(row);
+    editorRowAppendString(&E.row[E.cy-1],row->chars,row->size);
+    editorDelRow(E.cy);
+    E.cy--;
+}
+
+/*** multiple cursors ***/
+
+/*
+an edit takes every cursor at once, the primary one included, ordered by position
+so all cursors on a row are applied in one pass and the row is rebuilt and highlighted once
+*/
+
+int editorCursorCmp(const void *a, const void *b){
+    const struct cursor *x = a, *y = b;
+    if(x->cy != y->cy) return x->cy < y->cy ? -1 : 1;
+    return x->cx < y->cx ? -1 : x->cx > y->cx;
+}
+
+void editorCursorsReserve(int n){
+    if(n <= E.cursors.cap) return;
+    E.cursors.cap = E.cursors.cap * 2 > n ? E.cursors.cap * 2 : n;
+    E.cursors.all = realloc(E.cursors.all, sizeof(struct cursor) * E.cursors.cap);
+}
+
+//put the primary cursor in with the others, clamped to the text
+void editorCursorsGather(){
+    editorCursorsReserve(E.cursors.count+1);
+    struct cursor *primary = &E.cursors.all[E.cursors.count++];
+    primary->cx = E.cx;
+    primary->cy = E.cy;
+    primary->flags = CURSOR_PRIMARY;
+    for(int j=0;j<E.cursors.count;j++){
+        struct cursor *c = &E.cursors.all[j];
+        if(c->cy > E.numrows) c->cy = E.numrows;
+        int size = c->cy < E.numrows ? E.row[c->cy].size : 0;
+        if(c->cx > size) c->cx = size;
+    }
+    qsort(E.cursors.all, E.cursors.count, sizeof(struct cursor), editorCursorCmp);
+}
+
+//take the primary cursor back out, cursors an edit brought together become one
+void editorCursorsScatter(){
+    qsort(E.cursors.all, E.cursors.count, sizeof(struct cursor), editorCursorCmp);
+    int n = 0;
+    for(int j=0;j<E.cursors.count;j++){
+        struct cursor c = E.cursors.all[j];
+        c.flags &= CURSOR_PRIMARY;
+        if(n && !editorCursorCmp(&E.cursors.all[n-1], &c)){
+            E.cursors.all[n-1].flags |= c.flags;
+            continue;
+        }
+        E.cursors.all[n++] = c;
+    }
+    int m = 0;
+    for(int j=0;j<n;j++){
+        if(E.cursors.all[j].flags & CURSOR_PRIMARY){
+            E.cx = E.cursors.all[j].cx;
+            E.cy = E.cursors.all[j].cy;
+            continue;
+        }
+        E.cursors.all[m++] = E.cursors.all[j];
+    }
+    E.cursors.count = m;
+}
+
+//returns 0 if there already is a cursor there
+int editorCursorsAdd(int cy, int cx){
+    struct cursor c = { cx, cy, 0 };
+    if(cy == E.cy && cx == E.cx) return 0;
+    int lo = 0, hi = E.cursors.count;
+    while(lo < hi){
+        int mid = lo + (hi-lo)/2;
+        if(editorCursorCmp(&E.cursors.all[mid], &c) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    if(lo < E.cursors.count && !editorCursorCmp(&E.cursors.all[lo], &c)) return 0;
+    editorCursorsReserve(E.cursors.count+1);
+    memmove(&E.cursors.all[lo+1], &E.cursors.all[lo], sizeof(struct cursor) * (E.cursors.count - lo));
+    E.cursors.all[lo] = c;
+    E.cursors.count++;
+    return 1;
+}
+
+void editorCursorsClear(){
+    E.cursors.count = 0;
+    free(E.cursors.word);
+    E.cursors.word = NULL;
+}
+
+void editorCursorsInsertChar(int c){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    editorCursorsGather();
+    struct cursor *cur = E.cursors.all;
+    int n = E.cursors.count;
+    if(cur[n-1].cy == E.numrows) editorInsertRow(E.numrows,"",0);
+
+    //from the bottom, so a row whose comment state changes only runs into rows already done
+    for(int j=n;j>0;){
+        int i = j;
+        while(i > 0 && cur[i-1].cy == cur[j-1].cy) i--;
+        erow *row = &E.row[cur[i].cy];
+        editorRowLoad(row);
+        char *chars = malloc(row->size + (j-i) + 1);
+        int from = 0, len = 0;
+        for(int k=i;k<j;k++){
+            memcpy(&chars[len], &row->chars[from], cur[k].cx - from);
+            len += cur[k].cx - from;
+            from = cur[k].cx;
+            chars[len++] = c;
+            cur[k].cx = len;
+        }
+        memcpy(&chars[len], &row->chars[from], row->size - from + 1);
+        row->size = len + row->size - from;
+        editorRowDropChars(row);
+        row->chars = chars;
+        editorUpdateRow(row);
+        j = i;
+    }
+    E.dirty++;
+    editorCursorsScatter();
+}
+
+void editorCursorsDelChar(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    editorCursorsGather();
+    struct cursor *cur = E.cursors.all;
+    int n = E.cursors.count;
+
+    //characters before the cursors, a row at a time, rows are updated once everything is in place
+    int njoin = 0;
+    for(int i=0;i<n;){
+        int j = i;
+        while(j < n && cur[j].cy == cur[i].cy) j++;
+        if(cur[i].cy >= E.numrows) break;
+        erow *row = &E.row[cur[i].cy];
+        editorRowLoad(row);
+        editorRowOwnChars(row);
+        int from = 0, len = 0;
+        for(int k=i;k<j;k++){
+            if(cur[k].cx == 0){
+                if(cur[k].cy > 0){
+                    cur[k].flags |= CURSOR_JOIN;
+                    njoin++;
+                }
+                continue;
+            }
+            int at = cur[k].cx-1;
+            while(at > 0 && utf8IsCont(row->chars[at])) at--;
+            memmove(&row->chars[len], &row->chars[from], at - from);
+            len += at - from;
+            from = cur[k].cx;
+            cur[k].cx = len;
+        }
+        if(from > 0){
+            memmove(&row->chars[len], &row->chars[from], row->size - from + 1);
+            row->size = len + row->size - from;
+        }
+        i = j;
+    }
+
+    //then rows with a cursor at column 0 go onto the end of the row above, all rows after the first one move once
+    if(njoin){
+        struct rowShift *shifts = malloc(sizeof(struct rowShift) * njoin);
+        int *joinAt = malloc(sizeof(int) * njoin); //where the text of each joined row starts in the row it went to
+        int nshifts = 0;
+        for(int k=0;k<n;k++){
+            if(!(cur[k].flags & CURSOR_JOIN)) continue;
+            shifts[nshifts].at = cur[k].cy;
+            shifts[nshifts].delta = -1;
+            nshifts++;
+        }
+        rowShiftPrepare(shifts, nshifts);
+
+        int w = shifts[0].at-1, s = 0;
+        for(int r=w;r<E.numrows;){
+            erow *row = &E.row[r];
+            int m = 0;
+            while(s+m < nshifts && shifts[s+m].at == r+1+m) m++;
+            if(m){ //a run of joined rows is copied on in one go
+                editorRowChars(row);
+                int size = row->size;
+                for(int q=1;q<=m;q++){
+                    editorRowChars(&E.row[r+q]);
+                    size += E.row[r+q].size;
+                }
+                char *chars = malloc(size + 1);
+                memcpy(chars, row->chars, row->size);
+                int len = row->size;
+                for(int q=1;q<=m;q++){
+                    erow *joined = &E.row[r+q];
+                    joinAt[s+q-1] = len;
+                    memcpy(&chars[len], joined->chars, joined->size);
+                    len += joined->size;
+                    row->hlOpenComment = joined->hlOpenComment; //what the rows below were highlighted after
+                    editorFreeRow(joined);
+                }
+                chars[len] = '\0';
+                editorRowDropChars(row);
+                row->chars = chars;
+                row->size = len;
+            }
+            E.row[w] = *row;
+            E.row[w].idx = w;
+            w++;
+            r += 1+m;
+            s += m;
+        }
+        E.numrows = w;
+
+        //cursors of a joined row go along with its text
+        int total = shifts[nshifts-1].before + shifts[nshifts-1].delta;
+        s = 0;
+        for(int k=0;k<n;k++){
+            while(s < nshifts && shifts[s].at < cur[k].cy) s++;
+            if(s < nshifts && shifts[s].at == cur[k].cy){
+                cur[k].cy = shifts[s].at-1 + shifts[s].before;
+                cur[k].cx += joinAt[s];
+            } else {
+                cur[k].cy += s < nshifts ? shifts[s].before : total;
+            }
+        }
+        editorRowsShifted(shifts, nshifts);
+        free(shifts);
+        free(joinAt);
+    }
+
+    //every row with a cursor once, from the bottom so a changed comment state only runs into rows already done
+    for(int k=n-1;k>=0;k--){
+        if(cur[k].cy >= E.numrows || (k+1 < n && cur[k+1].cy == cur[k].cy)) continue;
+        editorUpdateRow(&E.row[cur[k].cy]);
+    }
+    E.dirty++;
+    editorCursorsScatter();
+}
+
+//cut every row at its cursors, the rows after the first cut move once for the whole batch
+void editorCursorsNewLine(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    editorCursorsGather();
+    struct cursor *cur = E.cursors.all;
+    int n = E.cursors.count;
+    int past = 0; //cursors past the last row only add an empty row
+    while(n > 0 && cur[n-1].cy == E.numrows){
+        past++;
+        n--;
+    }
+    if(past) editorInsertRow(E.numrows, "", 0);
+
+    if(n > 0){
+        struct rowShift *shifts = malloc(sizeof(struct rowShift) * n);
+        int nshifts = 0;
+        for(int i=0;i<n;){
+            int j = i;
+            while(j < n && cur[j].cy == cur[i].cy) j++;
+            shifts[nshifts].at = cur[i].cy+1;
+            shifts[nshifts].delta = j-i;
+            nshifts++;
+            i = j;
+        }
+        rowShiftPrepare(shifts, nshifts);
+
+        //from the bottom, every stretch of rows goes straight to where it ends up
+        editorRowsReserve(n);
+        int end = E.numrows;
+        for(int s=nshifts-1;s>=0;s--){
+            int at = shifts[s].at, by = shifts[s].before + shifts[s].delta;
+            memmove(&E.row[at+by], &E.row[at], sizeof(erow) * (end-at));
+            end = at;
+        }
+        E.numrows += n;
+        for(int j=shifts[0].at;j<E.numrows;j++) E.row[j].idx = j;
+
+        //a row keeps the text before its first cursor, the text after each cursor becomes a new row
+        for(int i=0, s=0;i<n;s++){
+            int j = i;
+            while(j < n && cur[j].cy == cur[i].cy) j++;
+            int at = cur[i].cy + shifts[s].before, cut = cur[i].cx;
+            erow *row = &E.row[at];
+            editorRowLoad(row);
+            for(int k=i;k<j;k++){
+                int to = k+1 < j ? cur[k+1].cx : row->size;
+                erow *piece = &E.row[at+1+k-i];
+                editorRowInit(piece, at+1+k-i, &row->chars[cur[k].cx], to - cur[k].cx);
+                piece->hlOpenComment = row->hlOpenComment; //the state the rows below were highlighted with
+                cur[k].cy = at+1+k-i;
+                cur[k].cx = 0;
+            }
+            editorRowOwnChars(row);
+            row->size = cut;
+            row->chars[cut] = '\0';
+            i = j;
+        }
+        editorRowsShifted(shifts, nshifts);
+        free(shifts);
+
+        //every new row and the row it was cut from once, from the bottom
+        for(int k=n-1;k>=0;k--){
+            editorUpdateRow(&E.row[cur[k].cy]);
+            if(k == 0 || cur[k-1].cy != cur[k].cy-1) editorUpdateRow(&E.row[cur[k].cy-1]);
+        }
+    }
+    for(int k=n;k<n+past;k++){
+        cur[k].cy = E.numrows;
+        cur[k].cx = 0;
+    }
+    editorCursorsScatter();
+}
+
+void editorCursorsMove(int key){
+    editorCursorsGather();
+    for(int k=0;k<E.cursors.count;k++){
+        struct cursor *c = &E.cursors.all[k];
+        E.cx = c->cx;
+        E.cy = c->cy;
+        editorMoveCursor(key);
+        c->cx = E.cx;
+        c->cy = E.cy;
+    }
+    editorCursorsScatter();
+}
+
+//ctrl d, the first press picks the word under the cursor, every press adds a cursor on its next occurrence
+void editorCursorsAddNextMatch(){
+    if(E.cy >= E.numrows) return;
+    erow *row = &E.row[E.cy];
+    editorRowLoad(row);
+    int start = E.cx, end = E.cx;
+    while(start > 0 && !isSeparator(row->chars[start-1])) start--;
+    while(end < row->size && !isSeparator(row->chars[end])) end++;
+    if(E.cursors.word == NULL){
+        if(start == end){
+            editorSetStatusMessage("No word under the cursor");
+            return;
+        }
+        E.cursors.word = strndup(&row->chars[start], end - start);
+        E.cursors.lastcy = E.cy;
+        E.cursors.lastcx = E.cx;
+    }
+    char *word = E.cursors.word;
+    int wlen = strlen(word);
+    int offset = E.cx - start; //where in the word the cursor sits
+    if(offset > wlen) offset = wlen;
+
+    //whole word matches only, wrapping around the end of the file once
+    int from = E.cursors.lastcx - offset + wlen;
+    for(int n=0;n<=E.numrows;n++){
+        int cy = (E.cursors.lastcy + n) % E.numrows;
+        erow *r = &E.row[cy];
+        int lazy = (r->render == NULL);
+        editorRowLoad(r);
+        char *p = &r->chars[n == 0 && from > 0 && from <= r->size ? from : 0];
+        char *match;
+        while((match = strstr(p, word)) != NULL){
+            int at = match - r->chars;
+            p = match+1;
+            if(at > 0 && !isSeparator(r->chars[at-1])) continue;
+            if(at + wlen < r->size && !isSeparator(r->chars[at+wlen])) continue;
+            if(!editorCursorsAdd(cy, at + offset)){
+                editorSetStatusMessage("Every match has a cursor");
+                return;
+            }
+            E.cursors.lastcy = cy;
+            E.cursors.lastcx = at + offset;
+            editorSetStatusMessage("%d cursors", E.cursors.count+1);
+            return;
+        }
+        if(lazy) editorRowUnload(r);
+        from = 0;
+    }
+}
+
+//ctrl a, a cursor on the row below the lowest one in the same screen column, building a column
+void editorCursorsAddBelow(){
+    int cy = E.cy;
+    if(E.cursors.count && E.cursors.all[E.cursors.count-1].cy > cy) cy = E.cursors.all[E.cursors.count-1].cy;
+    if(cy+1 >= E.numrows) return;
+    cy++;
+    erow *row = &E.row[cy];
+    editorRowLoad(row);
+    editorCursorsAdd(cy, editorRowRxToCx(row, E.rx));
+    editorSetStatusMessage("%d cursors", E.cursors.count+1);
+}
+
+/*** clipboard ***/
+
+/*
+whole rows go to the clipboard by handing over their chars, and come back by lending them out
+so cutting and pasting a block of any size only moves row metadata, rows copy chars once edited
+only the partial first and last lines of a selection are copied
+*/
+
+//selection ends in order, with the end clamped to the text
+void editorSelectionBounds(int *cy0, int *cx0, int *cy1, int *cx1){
+    int ay = E.sel.cy, ax = E.sel.cx, by = E.cy, bx = E.cx;
+    if(ay > by || (ay == by && ax > bx)){
+        ay = by; ax = bx;
+        by = E.sel.cy; bx = E.sel.cx;
+    }
+    if(ay > E.numrows) ay = E.numrows;
+    if(by > E.numrows) by = E.numrows;
+    *cy0 = ay;
+    *cx0 = ay < E.numrows && ax > E.row[ay].size ? E.row[ay].size : ax;
+    *cy1 = by;
+    *cx1 = by < E.numrows && bx > E.row[by].size ? E.row[by].size : bx;
+    if(ay >= E.numrows) *cx0 = 0;
+    if(by >= E.numrows) *cx1 = 0;
+}
+
+void editorClipboardSet(struct clipSpan *span){
+    if(E.clipboard) editorSpanRelease(E.clipboard);
+    E.clipboard = span;
+}
+
+struct clipSpan *editorSpanNew(int nlines){
+    struct clipSpan *span = malloc(sizeof(*span));
+    span->refs = 1;
+    span->nlines = nlines;
+    span->chars = malloc(sizeof(char *) * nlines);
+    span->sizes = malloc(sizeof(int) * nlines);
+    span->owner = malloc(sizeof(struct clipSpan *) * nlines);
+    span->syntax = E.syntax;
+    span->open = NULL;
+    span->brDelta = NULL;
+    span->brMin = NULL;
+    span->sym = NULL;
+    return span;
+}
+
+//a line of the span that is a copy of part of a row
+void editorSpanCopy(struct clipSpan *span, int line, erow *row, int from, int to){
+    editorRowChars(row);
+    span->chars[line] = malloc(to - from + 1);
+    memcpy(span->chars[line], &row->chars[from], to - from);
+    span->chars[line][to - from] = '\0';
+    span->sizes[line] = to - from;
+    span->owner[line] = span;
+}
+
+//a whole row as a line of the span, taken away from the row on a cut or shared with it on a copy
+void editorSpanTake(struct clipSpan *span, int line, erow *row, int cut){
+    editorRowChars(row);
+    span->chars[line] = row->chars;
+    span->sizes[line] = row->size;
+    span->owner[line] = row->span ? row->span : span;
+    if(cut){ //the row's reference, if it had one, moves over to the line
+        row->chars = NULL;
+        row->span = NULL;
+        return;
+    }
+    if(row->span) row->span->refs++; //the line holds one more
+    else { //the row now borrows from the span
+        row->span = span;
+        span->refs++;
+    }
+}
+
+//selected text into the clipboard, and out of the buffer when cutting
+void editorClipboardCopy(int cut){
+    if(!E.sel.active){
+        editorSetStatusMessage("No selection, ctrl b sets the mark");
+        return;
+    }
+    if(cut && E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    int cy0, cx0, cy1, cx1;
+    editorSelectionBounds(&cy0, &cx0, &cy1, &cx1);
+    if(cy0 == cy1 && cx0 == cx1) return;
+
+    struct clipSpan *span = editorSpanNew(cy1 - cy0 + 1);
+    if(cy0 == cy1){
+        editorSpanCopy(span, 0, &E.row[cy0], cx0, cx1);
+    } else {
+        if(cx0 == 0) editorSpanTake(span, 0, &E.row[cy0], cut);
+        else editorSpanCopy(span, 0, &E.row[cy0], cx0, E.row[cy0].size);
+        for(int j=cy0+1;j<cy1;j++) editorSpanTake(span, j - cy0, &E.row[j], cut);
+        if(cy1 < E.numrows) editorSpanCopy(span, cy1 - cy0, &E.row[cy1], 0, cx1);
+        else { //selection runs to the end of the file
+            span->chars[cy1 - cy0] = strdup("");
+            span->sizes[cy1 - cy0] = 0;
+            span->owner[cy1 - cy0] = span;
+        }
+        if(cy1 <= editorBracketsKnown()){ //a paste after the same state can skip highlighting the whole lines
+            span->open = malloc(span->nlines);
+            span->brDelta = malloc(sizeof(int) * span->nlines);
+            span->brMin = malloc(sizeof(int) * span->nlines);
+            span->sym = calloc(span->nlines, sizeof(struct symbol *));
+            for(int j=cy0;j<cy1;j++){
+                span->open[j - cy0] = E.row[j].hlOpenComment;
+                span->brDelta[j - cy0] = E.row[j].brDelta;
+                span->brMin[j - cy0] = E.row[j].brMin;
+                span->sym[j - cy0] = E.row[j].sym;
+                if(E.row[j].sym) E.row[j].sym->refs++;
+            }
+        }
+    }
+    editorClipboardSet(span);
+    E.sel.active = 0;
+    editorCursorsClear();
+
+    if(!cut){
+        editorSetStatusMessage("Copied %d lines", span->nlines);
+        return;
+    }
+
+    //what is left of the first and last row becomes one row, the rows between go in one move
+    if(cy0 == cy1){
+        erow *row = &E.row[cy0];
+        editorRowOwnChars(row);
+        memmove(&row->chars[cx0], &row->chars[cx1], row->size - cx1 + 1);
+        row->size -= cx1 - cx0;
+        editorUpdateRow(row);
+        E.dirty++;
+    } else {
+        if(cx0 == 0){ //the first row was handed over whole
+            if(cy1 < E.numrows){
+                erow *last = &E.row[cy1];
+                editorRowOwnChars(last);
+                memmove(last->chars, &last->chars[cx1], last->size - cx1 + 1);
+                last->size -= cx1;
+                editorUpdateRow(last);
+            }
+            editorDelRows(cy0, cy1 - cy0);
+        } else {
+            erow *first = &E.row[cy0];
+            first->size = cx0;
+            editorRowOwnChars(first);
+            first->chars[cx0] = '\0';
+            if(cy1 < E.numrows){
+                editorRowChars(&E.row[cy1]);
+                editorRowAppendString(first, &E.row[cy1].chars[cx1], E.row[cy1].size - cx1);
+            } else {
+                editorUpdateRow(first);
+            }
+            editorDelRows(cy0+1, (cy1 < E.numrows ? cy1 : cy1-1) - cy0);
+        }
+    }
+    E.cy = cy0;
+    E.cx = cx0;
+    editorSetStatusMessage("Cut %d lines", span->nlines);
+}
+
+//clipboard at the cursor, whole lines are lent to the new rows and left for the frontier to highlight
+void editorClipboardPaste(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    struct clipSpan *span = E.clipboard;
+    if(span == NULL) return;
+    E.sel.active = 0;
+    editorCursorsClear();
+    if(E.cy == E.numrows) editorInsertRow(E.numrows, "", 0);
+
+    erow *row = &E.row[E.cy];
+    editorRowChars(row);
+    int last = span->nlines - 1;
+    if(last == 0){
+        editorRowOwnChars(row);
+        row->chars = realloc(row->chars, row->size + span->sizes[0] + 1);
+        memmove(&row->chars[E.cx + span->sizes[0]], &row->chars[E.cx], row->size - E.cx + 1);
+        memcpy(&row->chars[E.cx], span->chars[0], span->sizes[0]);
+        row->size += span->sizes[0];
+        editorUpdateRow(row);
+        E.dirty++;
+        E.cx += span->sizes[0];
+        return;
+    }
+
+    //the tail of the cursor row goes after the last line
+    int taillen = row->size - E.cx;
+    char *tail = malloc(taillen + span->sizes[last] + 1);
+    memcpy(tail, span->chars[last], span->sizes[last]);
+    memcpy(&tail[span->sizes[last]], &row->chars[E.cx], taillen);
+    editorInsertRow(E.cy+1, tail, span->sizes[last] + taillen);
+    free(tail);
+
+    row = &E.row[E.cy];
+    editorRowOwnChars(row);
+    row->size = E.cx;
+    row->chars[row->size] = '\0';
+    editorRowAppendString(row, span->chars[0], span->sizes[0]);
+
+    editorOpenRows(E.cy+1, last-1);
+    for(int j=1;j<last;j++){
+        erow *r = &E.row[E.cy+j];
+        r->chars = span->chars[j];
+        r->size = span->sizes[j];
+        r->span = span->owner[j];
+        r->span->refs++;
+        r->offset = -1;
+        r->ascii = utf8IsAscii(r->chars, r->size);
+    }
+    //coming in after the same comment state the lines keep theirs, and the frontier goes past them
+    if(span->open && span->syntax == E.syntax && E.hlFrontier == E.cy+1 && E.row[E.cy].hlOpenComment == span->open[0]){
+        for(int j=1;j<last;j++){
+            erow *r = &E.row[E.cy+j];
+            r->hlOpenComment = span->open[j];
+            r->brDelta = span->brDelta[j];
+            r->brMin = span->brMin[j];
+            r->brKnown = 1;
+            editorRowSetSymbol(r, span->sym[j]);
+        }
+        E.hlFrontier = E.cy + last;
+    }
+    E.cy += last;
+    E.cx = span->sizes[last];
+}
+
+/*** filter ***/
+
+//rows a filter reads and replaces, the selected ones or the whole file
+void editorFilterRows(int *from, int *to){
+    if(!E.sel.active){
+        *from = 0;
+        *to = E.numrows;
+        return;
+    }
+    int cy0, cx0, cy1, cx1;
+    editorSelectionBounds(&cy0, &cx0, &cy1, &cx1);
+    *from = cy0;
+    *to = (cx1 == 0 && cy1 > cy0) ? cy1 : cy1 + 1; //a selection ending at the start of a row leaves that row out
+    if(*to > E.numrows) *to = E.numrows;
+}
+
+/*
+the piece of filter input at row, newline and where the one after it starts
+rows still as they were opened go out straight from the mapped file, as one range for as long as their lines follow each other there
+*/
+size_t editorFilterPiece(int row, int newline, int to, char **p, int *nextrow, int *nextnewline){
+    if(newline){
+        *p = "\n";
+        *nextrow = row+1;
+        *nextnewline = 0;
+        return 1;
+    }
+    erow *first = &E.row[row];
+    *nextnewline = 1;
+    if(E.map == NULL || first->offset < 0){
+        editorRowChars(first);
+        *p = first->chars;
+        *nextrow = row;
+        return first->size;
+    }
+    int last = row;
+    while(last+1 < to && E.row[last+1].offset >= 0 && E.row[last+1].offset == E.row[last].offset + E.row[last].size + 1) last++;
+    *p = &E.map[first->offset];
+    *nextrow = last;
+    return E.row[last].offset + E.row[last].size - first->offset;
+}
+
+//move on to the next piece, the rows it covers are only walked once
+void editorFilterAdvance(struct filterInput *in){
+    in->done = 0;
+    if(in->row >= in->to){
+        in->len = 0;
+        return;
+    }
+    in->len = editorFilterPiece(in->row, in->newline, in->to, &in->p, &in->row, &in->newline);
+}
+
+/*
+feed the command until the pipe is full
+long ranges of the mapped file are handed over with vmsplice, which leaves the pages where they are until the command reads them,
+short rows are packed together first, one pipe buffer per row would fill the pipe after a handful of them
+the rows stay untouched until the command has exited, so nothing changes under it
+returns 1 once everything is out, -1 when the command stopped reading
+*/
+int editorFilterWrite(int fd, struct filterInput *in){
+    while(1){
+        if(in->sent < in->buflen){
+            ssize_t written = write(fd, &in->buf[in->sent], in->buflen - in->sent);
+            if(written == -1) return errno == EAGAIN ? 0 : -1;
+            in->sent += written;
+            continue;
+        }
+        while(in->done == in->len && in->row < in->to) editorFilterAdvance(in);
+        if(in->done == in->len) return 1;
+
+        if(in->len - in->done >= QUILLO_FILTER_SPLICE_MIN){
+            struct iovec iov = {in->p + in->done, in->len - in->done};
+            ssize_t written = vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+            if(written == -1 && (errno == EINVAL || errno == ENOSYS)) written = write(fd, iov.iov_base, iov.iov_len);
+            if(written == -1) return errno == EAGAIN ? 0 : -1;
+            in->done += written;
+            continue;
+        }
+
+        in->buflen = in->sent = 0;
+        while(in->buflen < QUILLO_FILTER_CHUNK){
+            if(in->done == in->len){
+                if(in->row >= in->to) break;
+                editorFilterAdvance(in);
+                if(in->len >= QUILLO_FILTER_SPLICE_MIN) break;
+            }
+            size_t n = in->len - in->done;
+            if(n > (size_t)(QUILLO_FILTER_CHUNK - in->buflen)) n = QUILLO_FILTER_CHUNK - in->buflen;
+            memcpy(&in->buf[in->buflen], in->p + in->done, n);
+            in->buflen += n;
+            in->done += n;
+        }
+    }
+}
+
+void editorFilterAddLine(struct filterOutput *out, char *s, int len){
+    if(len > 0 && s[len-1] == '\r') len--;
+    if(out->n == out->cap){
+        out->cap = out->cap ? out->cap * 2 : 1024;
+        out->lines = realloc(out->lines, sizeof(char *) * out->cap);
+        out->sizes = realloc(out->sizes, sizeof(int) * out->cap);
+    }
+    out->lines[out->n] = malloc(len + 1);
+    memcpy(out->lines[out->n], s, len);
+    out->lines[out->n][len] = '\0';
+    out->sizes[out->n] = len;
+    out->n++;
+}
+
+//returns 1 at the end of the output, -1 on a read error and -2 once there is more than QUILLO_FILTER_MAX_OUTPUT
+int editorFilterRead(int fd, struct filterOutput *out){
+    char buf[QUILLO_FILTER_CHUNK];
+    while(1){ //drain the pipe, the command may be waiting for room
+        ssize_t nread = read(fd, buf, sizeof(buf));
+        if(nread == -1) return errno == EAGAIN ? 0 : -1;
+        if(nread == 0){ //a last line without a newline still counts
+            if(out->part) editorFilterAddLine(out, out->part, out->partlen);
+            return 1;
+        }
+        out->bytes += nread;
+        if(out->bytes > QUILLO_FILTER_MAX_OUTPUT) return -2;
+
+        char *p = buf, *end = buf + nread;
+        char *nl;
+        while((nl = memchr(p, '\n', end - p)) != NULL){
+            if(out->part){
+                out->part = realloc(out->part, out->partlen + (nl - p));
+                memcpy(&out->part[out->partlen], p, nl - p);
+                editorFilterAddLine(out, out->part, out->partlen + (nl - p));
+                free(out->part);
+                out->part = NULL;
+                out->partlen = 0;
+            } else {
+                editorFilterAddLine(out, p, nl - p);
+            }
+            p = nl + 1;
+        }
+        if(p < end){
+            out->part = realloc(out->part, out->partlen + (end - p));
+            memcpy(&out->part[out->partlen], p, end - p);
+            out->partlen += end - p;
+        }
+    }
+}
+
+void editorFilterFree(struct filterOutput *out){
+    for(int j=0;j<out->n;j++) free(out->lines[j]);
+    free(out->lines);
+    free(out->sizes);
+    free(out->part);
+}
+
+//reap the command, ESC still cancels while it runs on after closing its output, a cancelled one gets killed if it does not exit in time
+int editorFilterWait(pid_t pid, int *cancelled){
+    int status;
+    uint64_t killAt = 0;
+    while(1){
+        if(*cancelled && killAt == 0){
+            kill(-pid, SIGTERM);
+            killAt = perfNow() + QUILLO_FILTER_KILL_NS;
+        }
+        if(killAt && perfNow() >= killAt){
+            kill(-pid, SIGKILL);
+            killAt = UINT64_MAX;
+        }
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if(r == pid) return status;
+        if(r == -1 && errno != EINTR) die("waitpid");
+        struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+        char c;
+        if(poll(&fd, 1, 10) == 1 && read(STDIN_FILENO, &c, 1) == 1 && c == '\x1b') *cancelled = 1;
+    }
+}
+
+//the region goes and the output comes in as two bulk moves, the new rows take the lines and are left for the frontier to highlight
+void editorFilterReplace(int from, int to, struct filterOutput *out){
+    if(to > from) editorDelRows(from, to - from);
+    if(out->n) editorOpenRows(from, out->n);
+    for(int j=0;j<out->n;j++){
+        erow *row = &E.row[from+j];
+        row->chars = out->lines[j];
+        row->size = out->sizes[j];
+        row->offset = -1;
+        row->ascii = utf8IsAscii(row->chars, row->size);
+    }
+    out->n = 0; //the rows have the lines now
+}
+
+/*
+run the selected rows, or the whole file, through a shell command and put its output in their place
+input and output go through the pipes at the same time so neither side can fill up and stall the other
+*/
+void editorFilter(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
+    char *cmd = editorPrompt("Filter through: %s (ESC to cancel)", NULL);
+    if(cmd == NULL) return;
+    int from, to;
+    editorFilterRows(&from, &to);
+
+    int in[2], out[2];
+    if(pipe2(in, O_CLOEXEC) == -1){
+        free(cmd);
+        editorSetStatusMessage("Can't filter: %s", strerror(errno));
+        return;
+    }
+    if(pipe2(out, O_CLOEXEC) == -1){
+        close(in[0]);
+        close(in[1]);
+        free(cmd);
+        editorSetStatusMessage("Can't filter: %s", strerror(errno));
+        return;
+    }
+    pid_t pid = fork();
+    if(pid == 0){
+        setpgid(0, 0); //cancelling takes down everything the command started
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if(null != -1) dup2(null, STDERR_FILENO); //anything on stderr would land on the screen
+        signal(SIGPIPE, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    free(cmd);
+    close(in[0]);
+    close(out[1]);
+    if(pid > 0) setpgid(pid, pid); //whichever of the two gets there first
+    if(pid == -1){
+        close(in[1]);
+        close(out[0]);
+        editorSetStatusMessage("Can't filter: %s", strerror(errno));
+        return;
+    }
+    fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+    fcntl(out[0], F_SETFL, fcntl(out[0], F_GETFL) | O_NONBLOCK);
+    fcntl(in[1], F_SETPIPE_SZ, QUILLO_FILTER_PIPE);
+    fcntl(out[0], F_SETPIPE_SZ, QUILLO_FILTER_PIPE);
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN); //a command that stops reading early is not an error
+    editorSetStatusMessage("Filtering %d lines, ESC cancels", to - from);
+    editorRefreshScreen();
+
+    struct filterInput *input = malloc(sizeof(*input));
+    input->row = from;
+    input->newline = 0;
+    input->to = to;
+    input->len = input->done = 0;
+    input->buflen = input->sent = 0;
+    struct filterOutput output = {NULL, NULL, 0, 0, NULL, 0, 0};
+    int writing = 1, reading = 1, cancelled = 0, toobig = 0;
+    if(from >= to){
+        close(in[1]);
+        writing = 0;
+    }
+    while(reading && !cancelled){
+        struct pollfd fds[3] = {
+            {out[0], POLLIN, 0},
+            {writing ? in[1] : -1, POLLOUT, 0},
+            {STDIN_FILENO, POLLIN, 0}
+        };
+        if(poll(fds, 3, -1) == -1){
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(fds[0].revents){
+            int r = editorFilterRead(out[0], &output);
+            if(r == -1) cancelled = 1;
+            if(r == -2) cancelled = toobig = 1;
+            if(r != 0) reading = 0;
+        }
+        if(fds[1].revents && editorFilterWrite(in[1], input) != 0){
+            close(in[1]);
+            writing = 0;
+        }
+        char c;
+        if((fds[2].revents & POLLIN) && read(STDIN_FILENO, &c, 1) == 1 && c == '\x1b') cancelled = 1;
+    }
+    if(writing) close(in[1]);
+    close(out[0]);
+    free(input);
+    int status = editorFilterWait(pid, &cancelled);
+    signal(SIGPIPE, sigpipe);
+
+    if(cancelled || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        editorFilterFree(&output);
+        if(toobig) editorSetStatusMessage("Filter output passed %d MB, nothing changed", (int)(QUILLO_FILTER_MAX_OUTPUT >> 20));
+        else if(cancelled) editorSetStatusMessage("Filter cancelled");
+        else if(WIFEXITED(status)) editorSetStatusMessage("Filter exited with status %d, nothing changed", WEXITSTATUS(status));
+        else editorSetStatusMessage("Filter was killed, nothing changed");
+        return;
+    }
+
+    E.sel.active = 0;
+    editorCursorsClear();
+    editorSetStatusMessage("Filtered %d lines into %d", to - from, output.n);
+    editorFilterReplace(from, to, &output);
+    editorFilterFree(&output);
+    E.cy = from;
+    E.cx = 0;
+}
+
+/*** file i/o ***/
+
+int editorOpen(char *filename){
+    FILE *fp = fopen(filename, "r");
+    if(!fp) return -1;
+
+    free(E.filename);
+    E.filename = strdup(filename);
+    fstat(fileno(fp), &E.filestat);
+    E.cacheable = 1;
+
+    if(editorIndexLoad(fileno(fp))){
+        fclose(fp);
+        editorSelectSyntaxHL();
+        E.dirty = 0;
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+
+    E.follow.offset = 0;
+    E.follow.partial = 0;
+    while((linelen = getline(&line, &linecap, fp)) != -1){
+        int64_t offset = E.follow.offset;
+        E.follow.offset += linelen;
+        E.follow.partial = (line[linelen-1] != '\n');
+        int eol = linelen;
+        while(linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) linelen--;
+        editorInsertRow(E.numrows,line,linelen);
+        E.row[E.numrows-1].offset = offset;
+        E.row[E.numrows-1].eol = eol - linelen;
+        rowIndexUpdate(&E.bytes, &E.row[E.numrows-1]);
+    }    
+
+    editorSelectSyntaxHL();
+
+    free(line);
+    fclose(fp);
+
+    E.dirty = 0;
+    return 0;
+}
+
+/*** line index cache ***/
+
+/*
+sidecar written to the cache directory so reopening a big file skips scanning it for newlines
+layout is the header, then the start offset of every row, then its length without the line
+terminator, then a bitmap of every row's hlOpenComment for the syntax named in the header
+*/
+
+struct lineIndexHeader{
+    char magic[4];
+    uint32_t version;
+    uint64_t size; //of the indexed file, with mtime, inode and device it keys the index
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t ino;
+    uint64_t dev;
+    uint64_t nrows;
+    uint64_t end; //bytes of the file covered
+    uint32_t partial; //last row had no newline
+    char filetype[20]; //syntax the comment states were computed with, empty if none
+    uint64_t checksum; //of everything after the header
+};
+
+size_t editorIndexBodySize(uint64_t nrows){
+    return nrows * (sizeof(uint64_t) + sizeof(uint32_t)) + (nrows+7)/8;
+}
+
+//the sidecar name is a hash of the absolute path
+char *editorIndexPath(){
+    char *abs = realpath(E.filename, NULL);
+    if(abs == NULL) return NULL;
+    char *path = malloc(strlen(E.cachedir) + 32);
+    sprintf(path, "%s/%016llx.qidx", E.cachedir, (unsigned long long)editorHashRender(abs, strlen(abs)));
+    free(abs);
+    return path;
+}
+
+void editorIndexFillHeader(struct lineIndexHeader *h){
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, "QLIX", 4);
+    h->version = QUILLO_INDEX_VERSION;
+    h->size = E.filestat.st_size;
+    h->mtimeSec = E.filestat.st_mtim.tv_sec;
+    h->mtimeNsec = E.filestat.st_mtim.tv_nsec;
+    h->ino = E.filestat.st_ino;
+    h->dev = E.filestat.st_dev;
+}
+
+//build rows from a valid sidecar without reading the file, returns 0 if there is none or it is stale or corrupt
+int editorIndexLoad(int fd){
+    if(E.cachedir == NULL || E.numrows != 0) return 0;
+    char *path = editorIndexPath();
+    if(path == NULL) return 0;
+    int ifd = open(path, O_RDONLY);
+    free(path);
+    if(ifd == -1) return 0;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if(fstat(ifd, &st) == 0 && (size_t)st.st_size >= sizeof(struct lineIndexHeader)){
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ifd, 0);
+    }
+    close(ifd);
+    if(map == MAP_FAILED) return 0;
+
+    struct lineIndexHeader h, want;
+    memcpy(&h, map, sizeof(h));
+    editorIndexFillHeader(&want);
+    char *body = (char *)map + sizeof(h);
+    size_t bodysize = st.st_size - sizeof(h);
+
+    int valid = !memcmp(h.magic, want.magic, 4) && h.version == want.version && h.size == want.size
+        && h.mtimeSec == want.mtimeSec && h.mtimeNsec == want.mtimeNsec && h.ino == want.ino && h.dev == want.dev
+        && h.nrows < INT32_MAX && h.end <= h.size && bodysize == editorIndexBodySize(h.nrows)
+        && h.checksum == editorHashRender(body, bodysize);
+
+    if(valid && h.size > 0){
+        E.map = mmap(NULL, h.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(E.map == MAP_FAILED){
+            E.map = NULL;
+            valid = 0;
+        }
+        E.mapsize = h.size;
+    }
+    if(!valid){
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    uint64_t *offsets = (uint64_t *)body;
+    uint32_t *sizes = (uint32_t *)(body + h.nrows * sizeof(uint64_t));
+    unsigned char *open = (unsigned char *)(sizes + h.nrows);
+
+    E.row = malloc(sizeof(erow) * (h.nrows ? h.nrows : 1));
+    E.rowcap = h.nrows;
+    for(uint64_t i=0;i<h.nrows;i++){
+        erow *row = &E.row[i];
+        row->idx = i;
+        row->size = sizes[i];
+        row->rsize = 0;
+        row->rcols = 0;
+        row->wraps = 0;
+        row->ascii = 1;
+        row->chars = NULL;
+        row->render = NULL;
+        row->hl = NULL;
+        row->hlShared = NULL;
+        row->brKnown = 0;
+        row->sym = NULL;
+        row->span = NULL;
+        row->hlOpenComment = (open[i/8] >> (i%8)) & 1;
+        row->offset = offsets[i];
+        row->eol = (i+1 < h.nrows ? offsets[i+1] : h.end) - offsets[i] - sizes[i];
+        if(offsets[i] + sizes[i] > h.end || row->eol < 0) valid = 0; //never read outside the mapping
+    }
+    munmap(map, st.st_size);
+    if(!valid){ //checksum matched but the content makes no sense, start over
+        free(E.row);
+        E.row = NULL;
+        E.rowcap = 0;
+        munmap(E.map, E.mapsize);
+        E.map = NULL;
+        return 0;
+    }
+
+    E.numrows = h.nrows;
+    E.hlFrontier = E.numrows;
+    E.brackets.stale = 1;
+    E.brackets.pending = 0; //rows come with comment states but not bracket counts, those get done while idle
+    editorScheduleJob(editorBracketJob);
+    E.wrap.stale = 1;
+    E.bytes.stale = 1;
+    E.follow.offset = h.end;
+    E.follow.partial = h.partial;
+    E.cacheable = 0; //already in the cache
+
+    //the comment states are only of use if the same syntax gets selected again
+    E.hlStates = NULL;
+    for(unsigned int j=0;j<HLDB_ENTRIES;j++){
+        if(h.filetype[0] && !strncmp(HLDB[j].filetype, h.filetype, sizeof(h.filetype))) E.hlStates = &HLDB[j];
+    }
+    return 1;
+}
+
+//called on exit, writes the sidecar if the rows still describe the file on disk
+void editorIndexSave(){
+    if(E.cachedir == NULL || E.filename == NULL || !E.cacheable || E.dirty) return;
+    for(int i=0;i<E.numrows;i++){
+        if(E.row[i].offset < 0) return;
+    }
+    mkdir(E.cachedir, 0700);
+
+    struct lineIndexHeader h;
+    editorIndexFillHeader(&h);
+    h.nrows = E.numrows;
+    h.end = E.follow.offset;
+    h.partial = E.follow.partial;
+    int states = (E.syntax && E.hlFrontier >= E.numrows);
+    if(states) strncpy(h.filetype, E.syntax->filetype, sizeof(h.filetype)-1);
+
+    size_t bodysize = editorIndexBodySize(h.nrows);
+    char *body = calloc(1, bodysize ? bodysize : 1);
+    uint64_t *offsets = (uint64_t *)body;
+    uint32_t *sizes = (uint32_t *)(body + h.nrows * sizeof(uint64_t));
+    unsigned char *open = (unsigned char *)(sizes + h.nrows);
+    for(int i=0;i<E.numrows;i++){
+        offsets[i] = E.row[i].offset;
+        sizes[i] = E.row[i].size;
+        if(states && E.row[i].hlOpenComment) open[i/8] |= 1 << (i%8);
+    }
+    h.checksum = editorHashRender(body, bodysize);
+
+    //written under a temporary name and renamed so a reader never sees half an index
+    char *path = editorIndexPath();
+    if(path == NULL){
+        free(body);
+        return;
+    }
+    int tmplen = snprintf(NULL, 0, "%s.%d", path, (int)getpid()) + 1;
+    char *tmp = malloc(tmplen);
+    snprintf(tmp, tmplen, "%s.%d", path, (int)getpid());
+    FILE *fp = fopen(tmp, "w");
+    if(fp){
+        int ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(body, 1, bodysize, fp) == bodysize;
+        if(fclose(fp) == 0 && ok) rename(tmp, path);
+        else unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    free(body);
+}
+
+/*** pager ***/
+
+//copy stream bytes wherever they live, memory or the spill file
+void editorPagerCopy(char *dst, int64_t offset, int len){
+    while(len > 0){
+        int c = offset / QUILLO_PAGER_CHUNK;
+        int at = offset % QUILLO_PAGER_CHUNK;
+        int n = QUILLO_PAGER_CHUNK - at < len ? QUILLO_PAGER_CHUNK - at : len;
+        if(E.pager.chunks[c]) memcpy(dst, &E.pager.chunks[c][at], n);
+        else if(pread(E.pager.spill, dst, n, offset) != n) memset(dst, '?', n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+//push the oldest chunks out to the temp file until the memory cap is met
+void editorPagerSpill(){
+    if(E.pager.cap == 0) return;
+    while((size_t)(E.pager.nchunks - E.pager.firstResident) * QUILLO_PAGER_CHUNK > E.pager.cap
+        && E.pager.firstResident < E.pager.nchunks-1){
+        if(E.pager.spill == -1){
+            FILE *fp = tmpfile();
+            if(!fp) return;
+            E.pager.spill = dup(fileno(fp));
+            fclose(fp);
+        }
+        int c = E.pager.firstResident;
+        if(pwrite(E.pager.spill, E.pager.chunks[c], QUILLO_PAGER_CHUNK, (off_t)c * QUILLO_PAGER_CHUNK) != QUILLO_PAGER_CHUNK) return;
+        free(E.pager.chunks[c]);
+        E.pager.chunks[c] = NULL;
+        E.pager.firstResident++;
+    }
+}
+
+//under a cap even one erow per line adds up, so the array is file backed and paged out
+void editorPagerRowsMap(){
+    FILE *fp = tmpfile();
+    if(!fp) return;
+    int fd = dup(fileno(fp));
+    fclose(fp);
+    void *rows = mmap(NULL, QUILLO_PAGER_ROWS_MAX, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(rows == MAP_FAILED){ //no room to reserve, rows stay on the heap
+        close(fd);
+        return;
+    }
+    E.row = rows;
+    E.pager.rowfd = fd;
 }
 
-void editorDelRow(int at){
-    if(at < 0 || at >= E.numrows) return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at],&E.row[at +1],E.numrows-at);
-    for(int j=at; j<E.numrows-1;j++) E.row[j].idx--;
-    E.numrows--;
-    E.dirty++;
+//hand row pages that went over the cap back to the kernel, they come back from the file on the next touch
+void editorPagerTrimRows(){
+    size_t page = sysconf(_SC_PAGESIZE);
+    if((size_t)(E.numrows - E.pager.trimmed) * sizeof(erow) < E.pager.cap / 4) return;
+    uintptr_t from = (uintptr_t)&E.row[E.pager.trimmed] / page * page;
+    uintptr_t to = (uintptr_t)&E.row[E.numrows] / page * page;
+    if(to > from) madvise((void *)from, to - from, MADV_DONTNEED);
+    E.pager.trimmed = E.numrows;
 }
 
-void editorRowAppendString(erow *row, char *s, int len){
-    row->chars = realloc(row->chars,row->size + len +1);
-    memcpy(&row->chars[row->size],s,len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;    
+//rows are only described here, their contents get copied out when they are drawn or searched
+void editorPagerAddRow(int64_t offset, int size){
+    if(E.numrows == E.rowcap){
+        E.rowcap = E.rowcap ? E.rowcap * 2 : 64;
+        if(E.pager.rowfd == -1) E.row = realloc(E.row, sizeof(erow) * E.rowcap);
+        else if((size_t)E.rowcap * sizeof(erow) > QUILLO_PAGER_ROWS_MAX
+            || ftruncate(E.pager.rowfd, (off_t)E.rowcap * sizeof(erow)) == -1) die("pager rows");
+    }
+    erow *row = &E.row[E.numrows];
+    memset(row, 0, sizeof(*row));
+    row->idx = E.numrows;
+    row->size = size;
+    row->ascii = 1;
+    row->offset = offset;
+    row->eol = 1; //not used, the pager reads offsets straight off the rows
+    E.numrows++;
+    E.hlFrontier = E.numrows; //nothing to carry between rows without a syntax
+    E.bytes.stale = 1; //rows know their own offset, see editorRowOffset
+    //extended one row at a time while the row's chunk is still in memory instead of rebuilt over the whole stream,
+    //only turning soft wrap on builds it from every row
+    rowIndexAppend(&E.wrap);
+    bracketIndexAppend(); //not counted yet, pending stays behind it
 }
 
-/*** editor operations ***/
+//take what the pipe has for one time slice, splitting it into rows as newlines come in
+void editorPagerRead(){
+    uint64_t deadline = perfNow() + QUILLO_JOB_SLICE_NS;
+    int atEnd = (E.cy >= E.numrows-1 && E.numrows > 0);
+
+    while(E.pager.fd != -1 && perfNow() < deadline){
+        int c = E.pager.total / QUILLO_PAGER_CHUNK;
+        int at = E.pager.total % QUILLO_PAGER_CHUNK;
+        if(c == E.pager.nchunks){
+            E.pager.chunks = realloc(E.pager.chunks, sizeof(char *) * (E.pager.nchunks+1));
+            E.pager.chunks[E.pager.nchunks++] = malloc(QUILLO_PAGER_CHUNK);
+            editorPagerSpill();
+        }
 
-void editorInsertChar(int c){
-    if(E.cy == E.numrows){
-        editorInsertRow(E.numrows,"",0);
+        ssize_t n = read(E.pager.fd, &E.pager.chunks[c][at], QUILLO_PAGER_CHUNK - at);
+        if(n == -1 && (errno == EAGAIN || errno == EINTR)) break;
+        if(n <= 0){ //end of the stream, the last line may have no newline
+            if(E.pager.lineStart < E.pager.total){
+                editorPagerAddRow(E.pager.lineStart, E.pager.total - E.pager.lineStart - E.pager.cr);
+            }
+            close(E.pager.fd);
+            E.pager.fd = -1;
+            editorSetStatusMessage("%lld bytes read", (long long)E.pager.total);
+            break;
+        }
+
+        char *base = &E.pager.chunks[c][at];
+        char *p = base;
+        char *nl;
+        while((nl = memchr(p, '\n', base + n - p)) != NULL){
+            int64_t end = E.pager.total + (nl - base);
+            int cr = nl > base ? nl[-1] == '\r' : E.pager.cr;
+            if(end == E.pager.lineStart) cr = 0;
+            editorPagerAddRow(E.pager.lineStart, end - E.pager.lineStart - cr);
+            E.pager.lineStart = end+1;
+            p = nl+1;
+        }
+        E.pager.cr = (base[n-1] == '\r');
+        E.pager.total += n;
     }
-    editorRowInsertChar(&E.row[E.cy],E.cx,c);
-    E.cx++;
+    if(E.pager.rowfd != -1) editorPagerTrimRows();
+
+    if(atEnd) E.cy = E.numrows-1;
 }
 
-void editorDelChar(){
-    if(E.cy == E.numrows) return;
-    if(E.cx == 0 && E.cy == 0) return;
+//the stream takes over from stdin, keys come from the terminal instead
+void editorPagerStart(){
+    E.pager.fd = dup(STDIN_FILENO);
+    int tty = open("/dev/tty", O_RDONLY);
+    if(E.pager.fd == -1 || tty == -1 || dup2(tty, STDIN_FILENO) == -1) die("pager");
+    close(tty);
+    fcntl(E.pager.fd, F_SETFL, fcntl(E.pager.fd, F_GETFL) | O_NONBLOCK);
+
+    if(E.pager.cap) editorPagerRowsMap();
+    E.pager.active = 1;
+    E.readonly = 1;
+    E.brackets.pending = 0; //streamed rows get their brackets counted when a search needs them
+    E.filename = strdup("[stdin]");
+    editorPagerRead();
+}
 
-    erow *row = &E.row[E.cy];
+/*** follow mode ***/
 
-    if(E.cx > 0){
-        editorRowDelChar(row, E.cx-1);
-        E.cx--;
-        return;
+//add a piece of a line, joining it to the last row if that one was left unterminated
+void editorFollowAppend(char *s, int len, int terminated){
+    int eol = len + terminated;
+    while(len > 0 && s[len-1] == '\r') len--;
+    if(E.follow.partial && E.numrows > 0){
+        editorRowAppendString(&E.row[E.numrows-1], s, len);
+    } else {
+        editorInsertRow(E.numrows, s, len);
     }
-    E.cx = E.row[E.cy-1].size;
-    editorRowAppendString(&E.row[E.cy-1],row->chars,row->size);
-    editorDelRow(E.cy);
-    E.cy--;
+    E.row[E.numrows-1].eol = eol - len;
+    rowIndexUpdate(&E.bytes, &E.row[E.numrows-1]);
+    E.follow.partial = !terminated;
 }
 
-/*** file i/o ***/
+//read whatever was appended since the last call, only the new rows get highlighted
+void editorFollowRead(){
+    struct stat st;
+    if(fstat(E.follow.fd, &st) == -1) return;
+    if(st.st_size < E.follow.offset){ //truncated in place, start over from its new beginning
+        E.follow.offset = 0;
+        E.follow.partial = 0;
+        editorSetStatusMessage("%s was truncated", E.follow.name);
+    }
 
-void editorOpen(char *filename){
-    FILE *fp = fopen(filename, "r");
-    if(!fp) die("fopen");
+    int atEnd = (E.cy >= E.numrows-1);
+    int dirty = E.dirty;
+    char *buf = malloc(QUILLO_FOLLOW_CHUNK);
+    char *line = NULL; //a line that spans several reads
+    int linelen = 0;
+    ssize_t n;
+
+    while((n = pread(E.follow.fd, buf, QUILLO_FOLLOW_CHUNK, E.follow.offset)) > 0){
+        E.follow.offset += n;
+        char *p = buf;
+        char *end = buf + n;
+        char *nl;
+        while((nl = memchr(p, '\n', end-p)) != NULL){
+            if(line){
+                line = realloc(line, linelen + (nl-p));
+                memcpy(&line[linelen], p, nl-p);
+                editorFollowAppend(line, linelen + (nl-p), 1);
+                free(line);
+                line = NULL;
+                linelen = 0;
+            } else {
+                editorFollowAppend(p, nl-p, 1);
+            }
+            p = nl+1;
+        }
+        if(p < end){
+            line = realloc(line, linelen + (end-p));
+            memcpy(&line[linelen], p, end-p);
+            linelen += end-p;
+        }
+    }
+    if(line){
+        editorFollowAppend(line, linelen, 0);
+        free(line);
+    }
+    free(buf);
 
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+    E.dirty = dirty; //data coming from the file is not a modification
+    if(atEnd && E.numrows > 0) E.cy = E.numrows-1;
+}
 
-    while((linelen = getline(&line, &linecap, fp)) != -1){
-        while(linelen > 0 && (line[linelen-1] == '\n' || line[linelen-1] == '\r')) linelen--;
-        editorInsertRow(E.numrows,line,linelen);
-    }    
+//the file was rotated away, switch to whatever now lives under the name
+void editorFollowReopen(){
+    int fd = open(E.filename, O_RDONLY);
+    if(fd == -1) return; //not recreated yet, the directory watch will tell us
+    if(E.follow.wd != -1) inotify_rm_watch(E.follow.inotify, E.follow.wd);
+    close(E.follow.fd);
+
+    E.follow.fd = fd;
+    E.follow.wd = inotify_add_watch(E.follow.inotify, E.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    E.follow.offset = 0;
+    E.follow.partial = 0;
+    editorSetStatusMessage("%s was rotated, following the new file", E.follow.name);
+    editorFollowRead();
+}
 
-    free(E.filename);
-    E.filename = strdup(filename);
-    editorSelectSyntaxHL();
+void editorFollowEvents(){
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    int modified = 0, rotated = 0;
+
+    while((len = read(E.follow.inotify, buf, sizeof(buf))) > 0){
+        for(char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if(ev->wd == E.follow.wd){
+                if(ev->mask & IN_MODIFY) modified = 1;
+                if(ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) rotated = 1;
+                if(ev->mask & IN_IGNORED) E.follow.wd = -1;
+            } else if(ev->wd == E.follow.dirwd && ev->len && !strcmp(ev->name, E.follow.name)){
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) rotated = 1;
+            }
+        }
+    }
 
-    free(line);
-    fclose(fp);
+    //drain what the old file got before it went away, then move on
+    if(modified || rotated) editorFollowRead();
+    if(rotated) editorFollowReopen();
+}
 
-    E.dirty = 0;
+void editorFollowStart(){
+    if(E.filename == NULL) return;
+    E.follow.fd = open(E.filename, O_RDONLY);
+    E.follow.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(E.follow.fd == -1 || E.follow.inotify == -1) die("follow");
+
+    char *slash = strrchr(E.filename, '/');
+    E.follow.name = slash ? slash+1 : E.filename;
+    char *dir = slash ? strndup(E.filename, slash - E.filename + 1) : strdup(".");
+
+    E.follow.wd = inotify_add_watch(E.follow.inotify, E.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    E.follow.dirwd = inotify_add_watch(E.follow.inotify, dir, IN_CREATE | IN_MOVED_TO);
+    free(dir);
+    if(E.follow.wd == -1) die("inotify_add_watch");
+
+    //catch up on anything written between the snapshot and the watch
+    editorFollowRead();
+    E.cy = E.numrows > 0 ? E.numrows-1 : 0;
 }
 
 char *editorRowsToString(int *buflen){
@@ -604,7 +4456,8 @@ char *editorRowsToString(int *buflen){
     char *buf = malloc(totlen);
     char *p = buf;
     for(j=0; j<E.numrows; j++){
-        memcpy(p, E.row[j].chars, E.row[j].size);
+        //rows never loaded are copied straight from the mapped file
+        memcpy(p, E.row[j].chars ? E.row[j].chars : &E.map[E.row[j].offset], E.row[j].size);
         p += E.row[j].size;
         *p = '\n';
         p++;
@@ -613,7 +4466,33 @@ char *editorRowsToString(int *buflen){
     return buf;
 }
 
+/*
+the mapped file was just written over with buf, the old mapping does not hold the rows anymore
+the new file gets mapped and every row points at where its line is now, or keeps a copy of its text if that fails
+*/
+void editorSaveRemap(int fd, char *buf, int len){
+    munmap(E.map, E.mapsize);
+    E.map = (fd != -1 && len > 0) ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if(E.map == MAP_FAILED) E.map = NULL;
+    E.mapsize = len;
+    int64_t offset = 0;
+    for(int j=0;j<E.numrows;j++){
+        erow *row = &E.row[j];
+        if(E.map == NULL && row->chars == NULL){
+            row->chars = malloc(row->size + 1);
+            memcpy(row->chars, &buf[offset], row->size);
+            row->chars[row->size] = '\0';
+        }
+        row->offset = E.map ? offset : -1;
+        offset += row->size + 1;
+    }
+}
+
 void editorSave(){
+    if(E.readonly){
+        editorSetStatusMessage("Read only");
+        return;
+    }
     if(E.filename == NULL){
         E.filename = editorPrompt("Save as: %s", NULL);
     }
@@ -633,17 +4512,26 @@ void editorSave(){
 
     if(write(fd, buf, len) != len) goto error;
 
+    if(E.map) editorSaveRemap(fd, buf, len);
+    for(int j=0;j<E.numrows;j++) E.row[j].eol = 1; //every line went out with a \n
+    E.bytes.stale = 1;
     close(fd);
     free(buf);
+    if(E.follow.fd != -1){ //the file is the rows now, only what gets appended after this is new
+        E.follow.offset = len;
+        E.follow.partial = 0;
+    }
     E.dirty = 0;
+    E.cacheable = 0; //line offsets recorded at open no longer match the file
     editorSelectSyntaxHL();
     editorSetStatusMessage("%d bytes written to disk",len);
     return;
 
     error:
+    editorSetStatusMessage("I/O Error while saving: %s",strerror(errno));
+    if(E.map) editorSaveRemap(-1, buf, len); //the file may be cut short by now
     close(fd);
     free(buf);
-    editorSetStatusMessage("I/O Error while saving: %s",strerror(errno));
 }
 
 /*** search ***/
@@ -655,6 +4543,7 @@ void editorFindCallback(char *query, int key){
     static char *savedHl = NULL;
 
     if(savedHl){
+        editorRowOwnHl(&E.row[savedHlLine]);
         memcpy(E.row[savedHlLine].hl,savedHl,E.row[savedHlLine].rsize);
         free(savedHl);
         savedHl = NULL;
@@ -688,16 +4577,23 @@ void editorFindCallback(char *query, int key){
         else if(current == E.numrows) current = 0;
 
         erow *row = &E.row[current];
+        int lazy = (row->render == NULL);
+        editorRowLoad(row);
         char *match = strstr(row->render, query);
+        if(!match && lazy) editorRowUnload(row); //do not keep the whole file around after a search
         if(match){
             lastMatch = current;
             E.cy = current;
-            E.cx = editorRowRxToCx(row, match - row->render);
+            E.cx = editorRowRxToCx(row, editorRenderByteToCol(row, match - row->render));
             E.rowoffset = E.numrows;
+            E.wrapoffset = 0;
+            editorHighlightUpTo(current+1); //the match overlay must not be overwritten later
 
             savedHlLine = current;
             savedHl = malloc(row->rsize);
+            if(row->hl == NULL) editorUpdateSyntax(row);
             memcpy(savedHl, row->hl, row->rsize);
+            editorRowOwnHl(row);
             memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
             break;
         }
@@ -709,6 +4605,7 @@ void editorFind(){
     int savedcy = E.cy;
     int savedcoloff = E.coloffset;
     int savedrowoff = E.rowoffset;
+    int savedwrapoff = E.wrapoffset;
 
     char *query = editorPrompt("Search: %s", editorFindCallback);
 
@@ -720,6 +4617,256 @@ void editorFind(){
     E.cy = savedcy;
     E.coloffset = savedcoloff;
     E.rowoffset = savedrowoff;
+    E.wrapoffset = savedwrapoff;
+}
+
+/*** goto ***/
+
+void editorGotoLine(){
+    char *query = editorPrompt("Go to line: %s", NULL);
+    if(query == NULL) return;
+
+    long long line = strtoll(query, NULL, 10);
+    free(query);
+    if(line < 1) line = 1;
+    if(line > E.numrows) line = E.numrows;
+
+    E.cy = line > 0 ? line-1 : 0;
+    E.cx = 0;
+}
+
+void editorGotoOffset(){
+    char *query = editorPrompt("Go to byte offset: %s", NULL);
+    if(query == NULL) return;
+
+    long long offset = strtoll(query, NULL, 0);
+    free(query);
+    if(offset < 0) offset = 0;
+
+    int64_t rem;
+    if(E.pager.active){ //offsets only grow, so search the rows themselves
+        int lo = 0, hi = E.numrows;
+        while(lo < hi){
+            int mid = lo + (hi-lo)/2;
+            if(E.row[mid].offset <= offset) lo = mid+1;
+            else hi = mid;
+        }
+        E.cy = lo > 0 ? lo-1 : 0;
+        rem = E.numrows ? offset - E.row[E.cy].offset : 0;
+        if(E.cy == E.numrows-1 && rem > E.row[E.cy].size) E.cy = E.numrows;
+    } else {
+        rowIndexEnsure(&E.bytes);
+        rowIndexFind(&E.bytes, offset, &E.cy, &rem);
+    }
+    if(E.cy >= E.numrows){ //past the end of the file
+        E.cy = E.numrows;
+        rem = 0;
+    }
+    E.cx = (E.cy < E.numrows && rem > E.row[E.cy].size) ? E.row[E.cy].size : rem;
+}
+
+/*** buffers ***/
+
+void editorBufferStash(struct editorBuffer *b){
+    b->cx = E.cx;
+    b->cy = E.cy;
+    b->rx = E.rx;
+    b->rowoffset = E.rowoffset;
+    b->coloffset = E.coloffset;
+    b->wrapoffset = E.wrapoffset;
+    b->wrap = E.wrap;
+    b->wrapcols = E.wrapcols;
+    b->bytes = E.bytes;
+    b->brackets = E.brackets;
+    b->symbols = E.symbols;
+    b->numrows = E.numrows;
+    b->rowcap = E.rowcap;
+    b->row = E.row;
+    b->filename = E.filename;
+    b->dirty = E.dirty;
+    b->syntax = E.syntax;
+    b->hlFrontier = E.hlFrontier;
+    b->follow = E.follow;
+    b->filestat = E.filestat;
+    b->cacheable = E.cacheable;
+    b->map = E.map;
+    b->mapsize = E.mapsize;
+    b->hlStates = E.hlStates;
+    b->pager = E.pager;
+    b->readonly = E.readonly;
+    b->drawnFrom = E.drawnFrom;
+    b->drawnTo = E.drawnTo;
+    b->folds = E.folds;
+    b->cursors = E.cursors;
+    b->sel = E.sel;
+}
+
+void editorBufferRestore(struct editorBuffer *b){
+    E.cx = b->cx;
+    E.cy = b->cy;
+    E.rx = b->rx;
+    E.rowoffset = b->rowoffset;
+    E.coloffset = b->coloffset;
+    E.wrapoffset = b->wrapoffset;
+    E.wrap = b->wrap;
+    E.wrapcols = b->wrapcols;
+    E.bytes = b->bytes;
+    E.brackets = b->brackets;
+    E.symbols = b->symbols;
+    E.numrows = b->numrows;
+    E.rowcap = b->rowcap;
+    E.row = b->row;
+    E.filename = b->filename;
+    E.dirty = b->dirty;
+    E.syntax = b->syntax;
+    E.hlFrontier = b->hlFrontier;
+    E.follow = b->follow;
+    E.filestat = b->filestat;
+    E.cacheable = b->cacheable;
+    E.map = b->map;
+    E.mapsize = b->mapsize;
+    E.hlStates = b->hlStates;
+    E.pager = b->pager;
+    E.readonly = b->readonly;
+    E.drawnFrom = b->drawnFrom;
+    E.drawnTo = b->drawnTo;
+    E.folds = b->folds;
+    E.cursors = b->cursors;
+    E.sel = b->sel;
+
+    //the screen may have changed size while the buffer was hidden, otherwise its wrap index still holds
+    if(E.wrapcols != E.screencols) E.wrap.stale = 1;
+    if(E.hlFrontier < E.numrows) editorScheduleJob(editorHighlightJob);
+    if(E.brackets.pending < E.numrows && !E.pager.active) editorScheduleJob(editorBracketJob);
+}
+
+//start E off as an empty buffer
+void editorBufferReset(){
+    E.cx = 0;
+    E.cy = 0;
+    E.rx = 0;
+    E.rowoffset = 0;
+    E.coloffset = 0;
+    E.wrapoffset = 0;
+    memset(&E.wrap, 0, sizeof(E.wrap));
+    E.wrap.weight = editorWrapLines;
+    E.wrapcols = 0;
+    memset(&E.bytes, 0, sizeof(E.bytes));
+    E.bytes.weight = editorRowBytes;
+    memset(&E.brackets, 0, sizeof(E.brackets));
+    E.brackets.pending = INT_MAX;
+    memset(&E.symbols, 0, sizeof(E.symbols));
+    E.numrows = 0;
+    E.rowcap = 0;
+    E.row = NULL;
+    E.filename = NULL;
+    E.dirty = 0;
+    E.syntax = NULL;
+    E.hlFrontier = 0;
+    memset(&E.follow, 0, sizeof(E.follow));
+    E.follow.fd = -1;
+    E.follow.inotify = -1;
+    E.cacheable = 0;
+    E.map = NULL;
+    E.mapsize = 0;
+    E.hlStates = NULL;
+    memset(&E.pager, 0, sizeof(E.pager));
+    E.pager.fd = -1;
+    E.pager.spill = -1;
+    E.pager.rowfd = -1;
+    E.readonly = 0;
+    E.drawnFrom = E.drawnTo = 0;
+    memset(&E.folds, 0, sizeof(E.folds));
+    memset(&E.cursors, 0, sizeof(E.cursors));
+    E.sel.active = 0;
+}
+
+//give back everything the current buffer holds, highlights nobody else shares go with it
+void editorBufferFree(){
+    for(int j=0;j<E.numrows;j++) editorFreeRow(&E.row[j]);
+    if(E.pager.rowfd != -1){
+        munmap(E.row, QUILLO_PAGER_ROWS_MAX);
+        close(E.pager.rowfd);
+    } else {
+        free(E.row);
+    }
+    free(E.wrap.tree);
+    free(E.bytes.tree);
+    free(E.brackets.tree);
+    free(E.symbols.all);
+    free(E.symbols.names);
+    free(E.filename);
+    if(E.map) munmap(E.map, E.mapsize);
+    if(E.follow.fd != -1) close(E.follow.fd);
+    if(E.follow.inotify != -1) close(E.follow.inotify);
+    if(E.pager.fd != -1) close(E.pager.fd);
+    if(E.pager.spill != -1) close(E.pager.spill);
+    for(int c=0;c<E.pager.nchunks;c++) free(E.pager.chunks[c]);
+    free(E.pager.chunks);
+    free(E.folds.all);
+    free(E.folds.top);
+    free(E.cursors.all);
+    free(E.cursors.word);
+    editorHlCacheSweep();
+    editorBufferReset();
+}
+
+//add an empty buffer after the current one and switch to it
+void editorBufferNew(){
+    E.buffers = realloc(E.buffers, sizeof(struct editorBuffer) * (E.numbuffers+1));
+    editorBufferStash(&E.buffers[E.curbuffer]);
+    E.curbuffer++;
+    memmove(&E.buffers[E.curbuffer+1], &E.buffers[E.curbuffer], sizeof(struct editorBuffer) * (E.numbuffers - E.curbuffer));
+    E.numbuffers++;
+    editorBufferReset();
+}
+
+void editorBufferSwitch(int to){
+    if(E.numbuffers < 2) return;
+    to = (to + E.numbuffers) % E.numbuffers;
+    editorBufferStash(&E.buffers[E.curbuffer]);
+    E.curbuffer = to;
+    editorBufferRestore(&E.buffers[to]);
+}
+
+void editorBufferOpen(){
+    char *filename = editorPrompt("Open: %s", NULL);
+    if(filename == NULL) return;
+
+    if(E.filename || E.numrows) editorBufferNew(); //an untouched empty buffer is reused
+    if(editorOpen(filename) == -1){
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        editorBufferClose();
+    }
+    free(filename);
+}
+
+void editorBufferClose(){
+    editorIndexSave();
+    editorBufferFree();
+    if(E.numbuffers < 2) return; //the last buffer just stays empty
+
+    E.numbuffers--;
+    memmove(&E.buffers[E.curbuffer], &E.buffers[E.curbuffer+1], sizeof(struct editorBuffer) * (E.numbuffers - E.curbuffer));
+    if(E.curbuffer == E.numbuffers) E.curbuffer--;
+    editorBufferRestore(&E.buffers[E.curbuffer]);
+}
+
+int editorBuffersDirty(){
+    int dirty = (E.dirty != 0);
+    for(int j=0;j<E.numbuffers;j++){
+        if(j != E.curbuffer && E.buffers[j].dirty) dirty++;
+    }
+    return dirty;
+}
+
+//write the line index of every buffer on the way out
+void editorBuffersSave(){
+    editorBufferStash(&E.buffers[E.curbuffer]);
+    for(int j=0;j<E.numbuffers;j++){
+        editorBufferRestore(&E.buffers[j]);
+        editorIndexSave();
+    }
 }
 
 /*** append buffer ***/
@@ -727,16 +4874,21 @@ void editorFind(){
 struct abuf{
     char *b;
     int len;
+    int cap;
 };
 
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 void abAppend(struct abuf *ab, const char *s, int len){
-    char *new = realloc(ab->b, ab->len + len);
-
-    if(new == NULL) return;
-    memcpy(&new[ab->len],s,len);
-    ab->b = new;
+    if(ab->len + len > ab->cap){ //grow geometrically so a frame only reallocs a handful of times
+        int cap = ab->cap ? ab->cap : 4096;
+        while(cap < ab->len + len) cap *= 2;
+        char *new = realloc(ab->b, cap);
+        if(new == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(&ab->b[ab->len],s,len);
     ab->len += len;
 }
 
@@ -807,33 +4959,57 @@ void editorMoveCursor(int key){
             E.cy = E.rowoffset;
             break;
         case PAGE_DOWN:
+            if(E.softwrap){ //row at the bottom of the screen
+                int sub;
+                editorWrapEnsure();
+                editorWrapFind(editorWrapPrefix(E.rowoffset) + E.wrapoffset + E.screenrows-1, &E.cy, &sub);
+                if(E.cy > E.numrows) E.cy = E.numrows;
+                break;
+            }
+            if(E.folds.ntop){
+                E.cy = E.rowoffset;
+                for(int y=1;y<E.screenrows && E.cy < E.numrows;y++) E.cy = editorFoldNext(E.cy);
+                break;
+            }
             E.cy = E.rowoffset + E.screenrows -1;
             break;
         case ARROW_LEFT:
-            if(E.cx != 0) E.cx--;
+            if(E.cx != 0){
+                E.cx--;
+                editorRowLoad(row);
+                while(E.cx > 0 && utf8IsCont(row->chars[E.cx])) E.cx--;
+            }
             else if(E.cy > 0){
-                E.cy--;
+                E.cy = editorFoldPrev(E.cy);
                 E.cx = E.row[E.cy].size;
             }
             break;
         case ARROW_RIGHT:
-            if(row && E.cx < row->size) E.cx++;
+            if(row && E.cx < row->size){
+                E.cx++;
+                editorRowLoad(row);
+                while(E.cx < row->size && utf8IsCont(row->chars[E.cx])) E.cx++;
+            }
             else if(row && E.cx == row->size){
-                E.cy++;
+                E.cy = editorFoldNext(E.cy);
                 E.cx = 0;
             }
             break;
         case ARROW_UP:
-            if(E.cy != 0) E.cy--;
+            if(E.cy != 0) E.cy = editorFoldPrev(E.cy);
             break;
         case ARROW_DOWN:
-            if(E.cy != E.numrows) E.cy++;
+            if(E.cy != E.numrows) E.cy = editorFoldNext(E.cy);
             break;
     }
 
     row = (E.cy >= E.numrows)? NULL : &E.row[E.cy];
     int rowlen = row ? row->size : 0;
     if(E.cx > rowlen) E.cx = rowlen;
+    if(row && E.cx > 0){ //never leave the cursor inside a multi byte character
+        editorRowLoad(row);
+        while(E.cx > 0 && E.cx < rowlen && utf8IsCont(row->chars[E.cx])) E.cx--;
+    }
 }
 
 void editorProcessKeypress(){
@@ -843,7 +5019,7 @@ void editorProcessKeypress(){
     switch(c){
         //editor operations
         case CTRL_KEY('q'): //ctrl q = quit
-        if(E.dirty && quit_times > 0){
+        if(editorBuffersDirty() && quit_times > 0){
             editorSetStatusMessage("WARNING! File has unsaved changes. Press Ctrl Q %d more times to quit",quit_times);
             quit_times--;
             return;
@@ -860,23 +5036,110 @@ void editorProcessKeypress(){
             break;
 
         case CTRL_KEY('l'): //refresh screen
-        case '\x1b': //escape
+            break;
+
+        case '\x1b': //escape drops the extra cursors and the selection
+            editorCursorsClear();
+            E.sel.active = 0;
+            break;
+
+        case CTRL_KEY('b'): //set the mark, the selection runs from it to the cursor
+            E.sel.active = !E.sel.active;
+            E.sel.cx = E.cx;
+            E.sel.cy = E.cy;
+            break;
+
+        case CTRL_KEY('c'):
+            editorClipboardCopy(0);
+            break;
+
+        case CTRL_KEY('x'):
+            editorClipboardCopy(1);
+            break;
+
+        case CTRL_KEY('v'):
+            editorClipboardPaste();
+            break;
+
+        case CTRL_KEY('r'): //run the selection, or the whole file, through a command
+            editorFilter();
+            break;
+
+        case CTRL_KEY(']'): //jump to the matching bracket
+            editorBracketJump();
+            break;
+
+        case CTRL_KEY('y'): //jump to a definition by name
+            editorSymbolJump();
+            break;
+
+        case CTRL_KEY('d'): //add a cursor at the next match of the word under the cursor
+            editorCursorsAddNextMatch();
+            break;
+
+        case CTRL_KEY('a'): //add a cursor on the next row
+            editorCursorsAddBelow();
             break;
 
         case CTRL_KEY('f'):
             editorFind();
             break;
 
+        case CTRL_KEY('g'):
+            editorGotoLine();
+            break;
+
+        case CTRL_KEY('o'):
+            editorGotoOffset();
+            break;
+
+        case CTRL_KEY('w'): //toggle soft wrap
+            E.softwrap = !E.softwrap;
+            E.coloffset = 0;
+            E.wrapoffset = 0;
+            break;
+
+        case CTRL_KEY('p'): //toggle performance overlay
+            E.perf.overlay = !E.perf.overlay;
+            break;
+
+        case CTRL_KEY('e'): //open a file in a new buffer
+            editorBufferOpen();
+            break;
+
+        case CTRL_KEY('n'): //next buffer
+            editorBufferSwitch(E.curbuffer+1);
+            break;
+
+        case CTRL_KEY('t'): //fold or unfold the block starting on this row
+            editorFoldToggle();
+            break;
+
+        case CTRL_KEY('k'): //close buffer
+        if(E.dirty && quit_times > 0){
+            editorSetStatusMessage("WARNING! Buffer has unsaved changes. Press Ctrl K %d more times to close it",quit_times);
+            quit_times--;
+            return;
+        }
+            editorBufferClose();
+            break;
+
         //text operations
         case DELETE_KEY: 
         case BACKSPACE:
         case CTRL_KEY('h'): //old time backspace
+        if(E.cursors.count){
+            if(c == DELETE_KEY) editorCursorsMove(ARROW_RIGHT);
+            editorCursorsDelChar();
+            break;
+        }
         if(c == DELETE_KEY) editorMoveCursor(ARROW_RIGHT);
             editorDelChar();
             break;
         
         case '\r': //enter
-            editorInsertNewLine();
+            if(E.cursors.count) editorCursorsNewLine();
+            else editorInsertNewLine();
             break;
 
         //cursor movement
@@ -888,12 +5151,14 @@ void editorProcessKeypress(){
         case PAGE_DOWN:
         case HOME_KEY:
         case END_KEY:
-            editorMoveCursor(c);
+            if(E.cursors.count) editorCursorsMove(c);
+            else editorMoveCursor(c);
             break;
         
         //base case
         default:
-            editorInsertChar(c);
+            if(E.cursors.count) editorCursorsInsertChar(c);
+            else editorInsertChar(c);
             break;
     }
     quit_times = QUILLO_QUIT_TIMES;
@@ -901,15 +5166,33 @@ void editorProcessKeypress(){
 
 /*** output ***/
 void editorScroll(){
+    if(E.folds.ntop) editorFoldReveal(E.cy); //search, goto and edits can land inside a fold
     E.rx = 0;
     if(E.cy < E.numrows){
+        editorRowLoad(&E.row[E.cy]);
         E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
     }
+    if(E.softwrap){ //everything in screen lines, each lookup is O(log n)
+        editorWrapEnsure();
+        E.coloffset = 0;
+        int cursor = editorWrapCursorLine();
+        int top = editorWrapPrefix(E.rowoffset) + E.wrapoffset;
+        if(cursor < top) top = cursor;
+        if(cursor >= top + E.screenrows) top = cursor - E.screenrows+1;
+        editorWrapFind(top, &E.rowoffset, &E.wrapoffset);
+        return;
+    }
     //vertical
     if(E.cy < E.rowoffset){ //above the visible window
         E.rowoffset = E.cy;
     }
-    if(E.cy >= E.rowoffset + E.screenrows){ //below the visible window
+    if(E.folds.ntop){ //count visible rows back from the cursor, each fold is one step
+        int f = editorFoldAt(E.rowoffset);
+        if(f != -1) E.rowoffset = E.folds.top[f].start;
+        int top = E.cy;
+        for(int y=1;y<E.screenrows && top > E.rowoffset;y++) top = editorFoldPrev(top);
+        if(top > E.rowoffset) E.rowoffset = top;
+    } else if(E.cy >= E.rowoffset + E.screenrows){ //below the visible window
         E.rowoffset = E.cy - E.screenrows+1;
     }
     //horizontal
@@ -921,53 +5204,126 @@ void editorScroll(){
     }
 }
 
-void editorProcessRow(struct abuf *ab, erow *row, int len){
-    int currentColor = -1;
-    char *c = &row->render[E.coloffset];
-    unsigned char *hl = &row->hl[E.coloffset];
+//after the first row of a fold, if it fits on the screen line
+void editorDrawFoldMarker(struct abuf *ab, erow *row, int col){
+    char marker[32];
+    struct fold *f = &E.folds.top[editorFoldAt(row->idx+1)];
+    int len = snprintf(marker, sizeof(marker), " ... %d lines", f->end - f->start);
+    int used = row->rcols - col > 0 ? row->rcols - col : 0;
+    if(used + len > E.screencols) return;
+    abAppend(ab, "\x1b[7m", 4);
+    abAppend(ab, marker, len);
+    abAppend(ab, "\x1b[m", 3);
+}
+
+//draws the screen columns [col, col+width) of a row
+//render bytes [selFrom, selTo) are shown inverted
+void editorProcessRow(struct abuf *ab, erow *row, int col, int width, int selFrom, int selTo){
+    int start, len;
+    if(row->ascii){
+        start = col < row->rsize ? col : row->rsize;
+        len = row->rsize - start;
+        if(len > width) len = width;
+    } else {
+        //find the bytes that fit, a wide character cut by the left edge is blanked out
+        int at = 0, c = 0, w = 0;
+        while(at < row->rsize && c < col){
+            at += utf8RenderChar(&row->render[at], row->rsize - at, &w);
+            c += w;
+        }
+        for(;c > col && width > 0;c--,width--) abAppend(ab, " ", 1);
+        start = at;
+        while(at < row->rsize){
+            int n = utf8RenderChar(&row->render[at], row->rsize - at, &w);
+            if(w > width) break;
+            width -= w;
+            at += n;
+        }
+        len = at - start;
+    }
+
+    int current = HL_NORMAL;
+    char *c = &row->render[start];
+    unsigned char *hl = &row->hl[start];
+    int mark0 = E.pair.row0 == row->idx ? E.pair.at0 - start : -1; //brackets around the cursor
+    int mark1 = E.pair.row1 == row->idx ? E.pair.at1 - start : -1;
+
+    int selected = 0;
+    int j = 0;
+    while(j < len){
+        int insel = (start+j >= selFrom && start+j < selTo);
+        if(insel != selected){
+            if(insel) abAppend(ab, "\x1b[7m", 4);
+            else abAppend(ab, "\x1b[27m", 5);
+            selected = insel;
+        }
 
-    for(int j=0;j<len;j++){
         //non printable characters
-        if(iscntrl(c[j])){
+        if(!(c[j] & 0x80) && iscntrl(c[j])){
             char sym = (c[j] <= 26) ? '@' + c[j] : '?';
             abAppend(ab, "\x1b[7m",4);
             abAppend(ab,&sym, 1);
             abAppend(ab,"\x1b[m",3);
-            if(currentColor != -1){
-                char buf[16];
-                int clen = snprintf(buf,sizeof(buf),"\x1b[%dm",currentColor);
-                abAppend(ab,buf,clen);
+            if(hlColors[current].color != hlColors[HL_NORMAL].color){
+                abAppend(ab,hlColors[current].seq,hlColors[current].len);
             }
+            if(selected) abAppend(ab, "\x1b[7m", 4);
+            j++;
             continue;
         }
 
-        if(hl[j] == HL_NORMAL){
-            if(currentColor != -1) abAppend(ab, "\x1b[39m", 5);
-            abAppend(ab, &c[j], 1);
-            currentColor = -1;
-            continue;
+        //emit the whole run of same colored printable characters at once, a selection edge ends it too
+        int stop = len;
+        if(insel) stop = selTo - start < len ? selTo - start : len;
+        else if(start+j < selFrom && selFrom - start < len) stop = selFrom - start;
+        int paired = (j == mark0 || j == mark1);
+        int cls = paired ? HL_MATCH : hl[j];
+        int color = hlColors[cls].color;
+        int end = j+1;
+        if(mark0 > j && mark0 < stop) stop = mark0;
+        if(mark1 > j && mark1 < stop) stop = mark1;
+        while(end < stop && !paired && hlColors[hl[end]].color == color && ((c[end] & 0x80) || !iscntrl(c[end]))) end++;
+
+        if(color != hlColors[current].color){
+            current = cls;
+            abAppend(ab,hlColors[current].seq,hlColors[current].len);
         }
-        int color = editorSyntaxToColor(hl[j]);
-        if(color != currentColor){
-            currentColor = color;
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm",color);
-            abAppend(ab, buf, clen);
-        }        
-        abAppend(ab, &c[j], 1);
-    }    
-    abAppend(ab, "\x1b[39m", 5);
+        abAppend(ab, &c[j], end-j);
+        j = end;
+    }
+    if(selected) abAppend(ab, "\x1b[27m", 5);
+    abAppend(ab, hlColors[HL_NORMAL].seq, hlColors[HL_NORMAL].len);
 }
 
 void editorDrawRows(struct abuf *ab){
+    editorHighlightUpTo(E.rowoffset + E.screenrows);
+    editorBracketPair(0, &E.pair); //never highlights further than the screen for it
+
+    int cy0 = 0, cx0 = 0, cy1 = -1, cx1 = 0;
+    if(E.sel.active) editorSelectionBounds(&cy0, &cx0, &cy1, &cx1);
+
+    int filerow = E.rowoffset;
+    int sub = E.softwrap ? E.wrapoffset : 0; //screen line within a wrapped row
     for(int y=0;y<E.screenrows;y++){
-        int filerow = y + E.rowoffset;
         if(filerow < E.numrows){
-            int len = E.row[filerow].rsize - E.coloffset;
-            if(len < 0) len = 0;
-            if(len > E.screencols) len = E.screencols;
-
-            editorProcessRow(ab, &E.row[filerow],len);
+            editorHighlightUpTo(filerow+1); //rows past a fold
+            erow *row = &E.row[filerow];
+            if(row->hl == NULL) editorUpdateSyntax(row);
+            int start = E.softwrap ? editorWrapStart(row, sub) : E.coloffset;
+            int selFrom = 0, selTo = 0;
+            if(filerow >= cy0 && filerow <= cy1){
+                selFrom = filerow == cy0 ? editorRowCxToRender(row, cx0) : 0;
+                selTo = filerow == cy1 ? editorRowCxToRender(row, cx1) : row->rsize;
+            }
+            editorProcessRow(ab, row, start, E.screencols, selFrom, selTo);
+            if(E.folds.ntop && editorFoldAt(filerow+1) != -1 && (!E.softwrap || sub == editorWrapLines(&E.row[filerow])-1)){
+                editorDrawFoldMarker(ab, &E.row[filerow], start);
+            }
+        }
+        //a wrapped row continues on the next screen line, a folded one carries on after the fold
+        if(!E.softwrap || filerow >= E.numrows || ++sub >= editorWrapLines(&E.row[filerow])){
+            filerow = editorFoldNext(filerow);
+            sub = 0;
         }
 
         if(y == E.screenrows/3 && E.numrows == 0){
@@ -990,6 +5346,17 @@ void editorDrawRows(struct abuf *ab){
         abAppend(ab, "\x1b[K",3); //erase rest of line
         abAppend(ab,"\r\n",2); //newline
     }
+
+    int end = sub ? filerow+1 : filerow; //a wrapped row cut off at the bottom still counts
+
+    //rows scrolled out of view go back to their backing store so memory stays bounded
+    if(E.pager.active || E.map){
+        for(int j=E.drawnFrom;j<E.drawnTo && j<E.numrows;j++){
+            if(j < E.rowoffset || j >= end) editorRowUnload(&E.row[j]);
+        }
+    }
+    E.drawnFrom = E.rowoffset;
+    E.drawnTo = end;
 }
 
 void editorDrawStatusBar(struct abuf *ab){
@@ -998,8 +5365,20 @@ void editorDrawStatusBar(struct abuf *ab){
     char status[80], rstatus[80];
     int len = snprintf(status,sizeof(status),
         "%.30s - %d lines %s",E.filename ? E.filename : "[NO NAME]",E.numrows, E.dirty ? "(modified)":"");
+    if(E.numbuffers > 1){
+        len += snprintf(status+len,sizeof(status)-len," [%d/%d]",E.curbuffer+1,E.numbuffers);
+        if(len >= (int)sizeof(status)) len = sizeof(status)-1;
+    }
     
-    int rlen = snprintf(rstatus,sizeof(rstatus),"%s %d/%d",E.syntax?E.syntax->filetype:"plain text",E.cy+1,E.numrows);
+    int rlen;
+    if(E.perf.overlay){
+        struct perfFrame *f = &E.perf.trace[(E.perf.frames + QUILLO_PERF_TRACE - 1) % QUILLO_PERF_TRACE];
+        rlen = snprintf(rstatus,sizeof(rstatus),"p50 %lluus p99 %lluus | %d hl %d B",
+            (unsigned long long)perfPercentile(50),(unsigned long long)perfPercentile(99),f->hlrows,f->bytes);
+    } else {
+        rlen = snprintf(rstatus,sizeof(rstatus),"%s %d/%d @%lld",E.syntax?E.syntax->filetype:"plain text",E.cy+1,E.numrows,
+            (long long)(editorRowOffset(E.cy) + E.cx));
+    }
     if(len > E.screencols) len = E.screencols;
     abAppend(ab,status,len);
 
@@ -1024,27 +5403,104 @@ void editorDrawMessageBar(struct abuf *ab){
         abAppend(ab, E.statusmsg, msglen);
 }
 
+//the whole frame goes out in one write unless the terminal takes it partially
+void editorWriteFrame(const char *b, int len){
+    while(len > 0){
+        ssize_t n = write(STDOUT_FILENO, b, len);
+        if(n == -1){
+            if(errno == EINTR || errno == EAGAIN) continue;
+            return;
+        }
+        b += n;
+        len -= n;
+    }
+}
+
+//where column rx of filerow is on the screen, returns 0 if it is not visible
+int editorScreenPos(int filerow, int rx, int *y, int *x){
+    if(E.softwrap){
+        int line = editorWrapPrefix(filerow), start = 0;
+        if(filerow < E.numrows && editorFoldAt(filerow) == -1){
+            editorRowLoad(&E.row[filerow]);
+            line += editorWrapSub(&E.row[filerow], rx, &start);
+        }
+        *y = line - (editorWrapPrefix(E.rowoffset) + E.wrapoffset);
+        *x = rx - start;
+    } else {
+        *y = filerow - E.rowoffset;
+        if(E.folds.ntop){ //folds take one screen line each
+            *y = 0;
+            for(int r=E.rowoffset;r<filerow && *y < E.screenrows;r=editorFoldNext(r)) (*y)++;
+        }
+        *x = rx - E.coloffset;
+    }
+    return *y >= 0 && *y < E.screenrows && *x >= 0 && *x < E.screencols;
+}
+
+//extra cursors show as an inverted cell, only the ones on screen are looked at
+void editorDrawCursors(struct abuf *ab){
+    struct cursor top = { 0, E.rowoffset, 0 };
+    int lo = 0, hi = E.cursors.count;
+    while(lo < hi){
+        int mid = lo + (hi-lo)/2;
+        if(editorCursorCmp(&E.cursors.all[mid], &top) < 0) lo = mid+1;
+        else hi = mid;
+    }
+    for(int j=lo;j<E.cursors.count && E.cursors.all[j].cy < E.drawnTo;j++){
+        struct cursor *c = &E.cursors.all[j];
+        if(editorFoldAt(c->cy) != -1) continue;
+        erow *row = c->cy < E.numrows ? &E.row[c->cy] : NULL;
+        if(row) editorRowLoad(row);
+        int cx = row && c->cx > row->size ? row->size : c->cx;
+        int x, y;
+        if(!editorScreenPos(c->cy, row ? editorRowCxToRx(row, cx) : 0, &y, &x)) continue;
+
+        const char *glyph = " ";
+        int len = 1;
+        if(row && cx < row->size && row->chars[cx] != '\t'){
+            int cp;
+            len = utf8Decode(&row->chars[cx], row->size - cx, &cp);
+            glyph = (cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) ? "?" : &row->chars[cx];
+            if(glyph[0] == '?') len = 1;
+        }
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH\x1b[7m", y+1, x+1);
+        abAppend(ab, buf, n);
+        abAppend(ab, glyph, len);
+        abAppend(ab, "\x1b[m", 3);
+    }
+}
+
 void editorRefreshScreen(){
     editorScroll();
 
-    struct abuf ab = ABUF_INIT;
+    static struct abuf ab = ABUF_INIT; //reused across frames, only grows
+    ab.len = 0;
 
     abAppend(&ab, "\x1b[?25l", 6);//hide cursor
     abAppend(&ab, "\x1b[H", 3); //reset cursor
 
+    uint64_t start = perfNow();
     editorDrawRows(&ab);
     editorDrawStatusBar(&ab);
     editorDrawMessageBar(&ab);
+    perfAddSpan(PERF_DRAW, start);
+
+    if(E.cursors.count) editorDrawCursors(&ab);
 
     //place cursor where it should be
     char buf[32];
-    snprintf(buf,sizeof(buf),"\x1b[%d;%dH",(E.cy-E.rowoffset)+1,(E.rx-E.coloffset)+1);
+    int x, y;
+    editorScreenPos(E.cy, E.rx, &y, &x);
+    snprintf(buf,sizeof(buf),"\x1b[%d;%dH",y+1,x+1);
     abAppend(&ab,buf,strlen(buf));
 
     abAppend(&ab, "\x1b[?25h", 6);//show cursor
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    start = perfNow();
+    editorWriteFrame(ab.b, ab.len);
+    perfAddSpan(PERF_WRITE, start);
+    perfEndFrame(ab.len);
 }
 
 void editorSetStatusMessage(const char *fmt, ...){
@@ -1058,31 +5514,69 @@ void editorSetStatusMessage(const char *fmt, ...){
 /*** init ***/
 
 void initEditor(){
-    E.cx = 0;
-    E.cy = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.rowoffset = 0;
-    E.coloffset = 0;
-    E.rx = 0;
-    E.filename = NULL;
+    editorBufferReset();
+    E.buffers = malloc(sizeof(struct editorBuffer));
+    E.numbuffers = 1;
+    E.curbuffer = 0;
+    E.softwrap = 0;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    if(getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-    E.screenrows -= 2;
-    E.dirty = 0;
-    E.syntax = NULL;
+    editorUpdateWindowSize();
+    editorInitColors();
+    memset(&E.perf, 0, sizeof(E.perf));
+    E.cachedir = NULL;
+    E.numjobs = 0;
 }
 
 int main(int argc, char *argv[]){
     initEditor();
-    enableRawMode();
 
-    if(argc >= 2){
-        editorOpen(argv[1]);
+    int opt;
+    int follow = 0;
+    while((opt = getopt(argc, argv, "fC:m:P:")) != -1){
+        switch(opt){
+            case 'f': //follow data appended to the file, like tail -f
+                follow = 1;
+                break;
+            case 'C': //keep line index sidecars in this directory
+                E.cachedir = optarg;
+                break;
+            case 'm': //megabytes of piped data kept in memory, the rest is spilled to a temp file
+                E.pager.cap = (size_t)atol(optarg) << 20;
+                break;
+            case 'P': //dump latency histogram and frame trace on exit
+                E.perf.dumpfile = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-f] [-C cachedir] [-m megabytes] [-P tracefile] [file... | -]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    if(follow) E.cachedir = NULL; //a growing file never matches its index
+
+    //has to happen before raw mode, it swaps stdin for the terminal
+    int paging = (optind < argc && !strcmp(argv[optind], "-"));
+    if(paging) editorPagerStart();
+
+    enableRawMode();
+    atexit(perfDump);
+
+    struct sigaction sa; //no SA_RESTART, poll has to wake up on resize
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleWinch;
+    sigaction(SIGWINCH, &sa, NULL);
+
+    //every file on the command line gets a buffer, the first one is shown
+    for(int j=optind;j<argc && !paging;j++){
+        if(j > optind) editorBufferNew();
+        if(editorOpen(argv[j]) == -1) die("fopen");
+        if(follow) editorFollowStart();
     }
+    editorBufferSwitch(0);
+    atexit(editorBuffersSave);
 
-    editorSetStatusMessage("HELP: Ctrl-q = quit  Ctrl-s = save  Ctrl-f = find");
+    editorSetStatusMessage("HELP: Ctrl-q = quit  Ctrl-s = save  Ctrl-f = find  Ctrl-e = open  Ctrl-n = next");
 
     while(1){
         editorRefreshScreen();
@@ -0,0 +1,841 @@
+/*
+standalone checks of what quillo keeps next to its rows, run by make check
+quillo.c comes in whole with its main renamed, so these go through the same code the editor runs
+no terminal is needed, the screen size is set by hand
+*/
+#define main quillo_main
+#include "../quillo.c"
+#undef main
+
+int failures;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+}while(0)
+
+//what the buffer should hold, edits are done on it one cursor at a time in plain C
+struct checkModel{
+    char **line;
+    int n;
+    int cap;
+} model;
+
+//lines random files are made of, between them they define symbols, nest brackets, open and close comments
+char *checkPool[] = {
+    "int f%d(void){",
+    "}",
+    "struct s%d {",
+    "    x = (a[%d] + b);",
+    "/* open %d",
+    "close */ y(",
+    "typedef int t%d;",
+    "",
+    "\tcall(%d); // ( not counted",
+    "char *s = \"{%d\";",
+    "\xe4\xb8\xad\xe6\x96\x87 %d \xe6\x96\x87)",
+    "static void g%d(int a, char *b)",
+};
+
+unsigned long checkSeed = 1;
+
+int checkRand(int n){
+    checkSeed = checkSeed * 6364136223846793005ul + 1442695040888963407ul;
+    return (checkSeed >> 33) % n;
+}
+
+void checkModelInsert(int at, const char *s, int len){
+    if(model.n == model.cap){
+        model.cap = model.cap ? model.cap * 2 : 64;
+        model.line = realloc(model.line, sizeof(char *) * model.cap);
+    }
+    memmove(&model.line[at+1], &model.line[at], sizeof(char *) * (model.n - at));
+    model.line[at] = strndup(s, len);
+    model.n++;
+}
+
+void checkModelDelete(int at){
+    free(model.line[at]);
+    memmove(&model.line[at], &model.line[at+1], sizeof(char *) * (model.n - at - 1));
+    model.n--;
+}
+
+//drop whatever buffer is open and start a new one from the model, fully highlighted with every index built
+void checkOpen(){
+    for(int j=0;j<E.numrows;j++) editorFreeRow(&E.row[j]);
+    free(E.row);
+    free(E.wrap.tree);
+    free(E.bytes.tree);
+    free(E.brackets.tree);
+    free(E.symbols.all);
+    free(E.symbols.names);
+    free(E.folds.all);
+    free(E.folds.top);
+    free(E.cursors.all);
+    free(E.filename);
+    editorSymbolForget();
+    editorBufferReset();
+    E.filename = strdup("check.c");
+    for(int j=0;j<model.n;j++) editorInsertRow(j, model.line[j], strlen(model.line[j]));
+    editorSelectSyntaxHL();
+    while(E.numjobs) editorRunJobs();
+    editorWrapEnsure();
+    rowIndexEnsure(&E.bytes);
+    bracketIndexEnsure();
+    E.dirty = 0;
+}
+
+void checkRandomModel(int nrows){
+    while(model.n) checkModelDelete(model.n-1);
+    for(int j=0;j<nrows;j++){
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf), checkPool[checkRand(sizeof(checkPool) / sizeof(checkPool[0]))], checkRand(1000));
+        checkModelInsert(j, buf, len);
+    }
+}
+
+//the buffer holds the model's text
+void checkText(){
+    CHECK(E.numrows == model.n);
+    for(int j=0;j<E.numrows && j<model.n;j++){
+        editorRowChars(&E.row[j]);
+        CHECK(E.row[j].size == (int)strlen(model.line[j]) && !memcmp(E.row[j].chars, model.line[j], E.row[j].size));
+    }
+}
+
+//everything kept next to the rows agrees with what a fresh look at the rows gives
+void checkIndexes(){
+    int inComment = 0, count = 0;
+    for(int j=0;j<E.numrows;j++){
+        erow *row = &E.row[j];
+        CHECK(row->idx == j);
+        if(row->sym) count++;
+        if(j >= E.hlFrontier) continue;
+        editorRowLoad(row);
+        unsigned char *hl = malloc(row->rsize + 1);
+        int out = editorHighlightLine(E.syntax, row->render, row->rsize, hl, inComment);
+        CHECK(row->hl && !memcmp(row->hl, hl, row->rsize));
+        CHECK(row->hlOpenComment == out);
+        int delta, min;
+        editorBracketCount(row->render, hl, row->rsize, &delta, &min);
+        CHECK(row->brKnown && row->brDelta == delta && row->brMin == min);
+        struct symbol *sym = editorSymbolParse(row->render, hl, row->rsize);
+        CHECK((sym == NULL) == (row->sym == NULL));
+        if(sym && row->sym) CHECK(!strcmp(sym->name, row->sym->name));
+        editorSymbolRelease(sym);
+        free(hl);
+        inComment = out;
+    }
+
+    struct symbolIndex *ix = &E.symbols;
+    CHECK(ix->count == count);
+    for(int i=0;i<ix->count;i++){
+        struct symbolRef *r = symbolIndexAt(i);
+        CHECK(r->row >= 0 && r->row < E.numrows);
+        if(r->row < 0 || r->row >= E.numrows) continue;
+        if(i > 0) CHECK(symbolIndexAt(i-1)->row < r->row);
+        struct symbol *sym = E.row[r->row].sym;
+        CHECK(sym != NULL);
+        if(sym == NULL) continue;
+        CHECK(symbolNameLen(r->name) == sym->len);
+        for(int k=0;k<sym->len && k<64;k++) CHECK(ix->names[r->name + SYMBOL_NAME_HEADER + k] == tolower((unsigned char)sym->name[k]));
+    }
+
+    struct rowIndex *trees[] = { &E.wrap, &E.bytes };
+    for(int t=0;t<2;t++){
+        struct rowIndex *tree = trees[t];
+        if(tree->stale || tree->from != INT_MAX || tree->tree == NULL || tree->n != E.numrows || (tree == &E.wrap && E.wrapcols != E.screencols)) continue;
+        int64_t sum = 0;
+        for(int j=0;j<=E.numrows;j++){
+            CHECK(rowIndexPrefix(tree, j) == sum);
+            if(j < E.numrows) sum += tree->weight(&E.row[j]);
+        }
+    }
+    for(int j=0;j<E.numrows && E.wrapcols == E.screencols;j++){ //a kept wrap count is what counting again gives
+        int wraps = E.row[j].wraps;
+        if(wraps == 0 || editorFoldAt(j) != -1) continue;
+        E.row[j].wraps = 0;
+        CHECK(editorWrapLines(&E.row[j]) == wraps);
+    }
+
+    if(!E.brackets.stale && E.brackets.tree && E.brackets.n == E.numrows){
+        int depth = 0;
+        for(int j=0;j<E.numrows;j++){
+            CHECK(bracketIndexPrefix(j) == depth);
+            if(E.row[j].brKnown) depth += E.row[j].brDelta;
+        }
+    }
+
+    for(int j=0;j<E.folds.count;j++){
+        struct fold *f = &E.folds.all[j];
+        CHECK(f->start < f->end && f->end < E.numrows);
+        if(j > 0) CHECK(E.folds.all[j-1].start <= f->start);
+    }
+}
+
+void checkAll(){
+    checkText();
+    checkIndexes();
+    while(E.numjobs) editorRunJobs();
+    editorHighlightUpTo(E.numrows);
+    editorWrapEnsure();
+    rowIndexEnsure(&E.bytes);
+    bracketIndexEnsure();
+    checkIndexes();
+}
+
+void checkRowShift(){
+    struct rowShift ins[] = { { 2, 1, 0 }, { 5, 3, 0 } };
+    rowShiftPrepare(ins, 2);
+    int gone, expect[] = { 0, 1, 3, 4, 5, 9, 10 };
+    for(int r=0;r<7;r++){
+        CHECK(rowShiftMap(ins, 2, r, &gone) == expect[r]);
+        CHECK(!gone);
+    }
+
+    struct rowShift del[] = { { 1, -1, 0 }, { 4, -2, 0 } };
+    rowShiftPrepare(del, 2);
+    int rows[] = { 0, 1, 2, 3, 4, 5, 6, 7 }, to[] = { 0, 1, 1, 2, 3, 3, 3, 4 }, dropped[] = { 0, 1, 0, 0, 1, 1, 0, 0 };
+    for(int j=0;j<8;j++){
+        CHECK(rowShiftMap(del, 2, rows[j], &gone) == to[j]);
+        CHECK(gone == dropped[j]);
+    }
+}
+
+int checkFoldCmp(const void *a, const void *b){
+    const struct fold *x = a, *y = b;
+    if(x->start != y->start) return x->start - y->start;
+    return y->end - x->end;
+}
+
+//a batch of shifts moves folds where the same shifts done one at a time from the bottom do
+void checkFolds(){
+    for(int round=0;round<200;round++){
+        int nrows = 40, nfolds = 1 + checkRand(8), nshifts = 1 + checkRand(6), insert = checkRand(2);
+        struct fold folds[8];
+        for(int j=0;j<nfolds;j++){
+            folds[j].start = checkRand(nrows-1);
+            folds[j].end = folds[j].start + 1 + checkRand(nrows - folds[j].start - 1);
+        }
+        struct rowShift s[6];
+        int n = 0, at = 1 + checkRand(4);
+        for(int j=0;j<nshifts && at < nrows;j++){
+            s[n].at = at;
+            s[n].delta = insert ? 1 + checkRand(3) : -(1 + checkRand(2));
+            if(at - s[n].delta > nrows) break;
+            at += (insert ? 0 : -s[n].delta) + 1 + checkRand(5);
+            n++;
+        }
+        if(n == 0) continue;
+        rowShiftPrepare(s, n);
+
+        struct fold *all = malloc(sizeof(folds));
+        memcpy(all, folds, sizeof(folds));
+        qsort(all, nfolds, sizeof(struct fold), checkFoldCmp);
+        E.numrows = nrows;
+        E.folds.all = all;
+        E.folds.count = E.folds.cap = nfolds;
+        editorFoldRemap(s, n);
+        int count = E.folds.count;
+        struct fold batch[8];
+        memcpy(batch, E.folds.all, sizeof(struct fold) * count);
+
+        memcpy(E.folds.all, folds, sizeof(folds));
+        qsort(E.folds.all, nfolds, sizeof(struct fold), checkFoldCmp);
+        E.folds.count = nfolds;
+        for(int j=n-1;j>=0;j--) editorFoldShift(s[j].at, s[j].delta);
+        CHECK(E.folds.count == count);
+        for(int j=0;j<count && j<E.folds.count;j++) CHECK(E.folds.all[j].start == batch[j].start && E.folds.all[j].end == batch[j].end);
+        E.folds.count = 0;
+        E.numrows = 0;
+    }
+}
+
+//rows added, removed and edited one at a time keep every index in step
+void checkRowEdits(){
+    checkRandomModel(200);
+    checkOpen();
+    checkAll();
+    for(int round=0;round<1000;round++){
+        char buf[128];
+        int at = checkRand(model.n+1), op = checkRand(4);
+        if(op == 0){
+            int len = snprintf(buf, sizeof(buf), checkPool[checkRand(sizeof(checkPool) / sizeof(checkPool[0]))], round);
+            editorInsertRow(at, buf, len);
+            checkModelInsert(at, buf, len);
+        } else if(op == 1 && at < model.n){
+            editorDelRow(at);
+            checkModelDelete(at);
+        } else if(op == 2 && at < model.n){
+            int n = 1 + checkRand(5);
+            if(at + n > model.n) n = model.n - at;
+            editorDelRows(at, n);
+            for(int j=0;j<n;j++) checkModelDelete(at);
+        } else if(at < model.n){
+            int len = strlen(model.line[at]), c = "{}()/*ab"[checkRand(8)];
+            int cx = checkRand(len+1);
+            while(cx > 0 && utf8IsCont(model.line[at][cx])) cx--;
+            editorRowInsertChar(&E.row[at], cx, c);
+            model.line[at] = realloc(model.line[at], len+2);
+            memmove(&model.line[at][cx+1], &model.line[at][cx], len - cx + 1);
+            model.line[at][cx] = c;
+        }
+        if(round % 10 == 0) checkAll();
+        else checkText();
+    }
+    checkAll();
+}
+
+struct cursor checkCursors[16];
+int checkNCursors;
+
+int checkCursorDesc(const void *a, const void *b){
+    return -editorCursorCmp(a, b);
+}
+
+//a cursor is only taken out when it ends up where another one already is
+void checkModelDedupe(){
+    qsort(checkCursors, checkNCursors, sizeof(struct cursor), editorCursorCmp);
+    int n = 0;
+    for(int j=0;j<checkNCursors;j++){
+        if(n && !editorCursorCmp(&checkCursors[n-1], &checkCursors[j])) continue;
+        checkCursors[n++] = checkCursors[j];
+    }
+    checkNCursors = n;
+}
+
+//the edit of cursor k in the model, the ones before it in the list are further down, already had theirs and move along with the text
+void checkModelEdit(int op, int k){
+    struct cursor *c = &checkCursors[k];
+    if(op == 'n'){
+        if(c->cy == model.n){
+            checkModelInsert(model.n, "", 0);
+            c->cy = model.n;
+            return;
+        }
+        char *line = model.line[c->cy];
+        checkModelInsert(c->cy+1, &line[c->cx], strlen(line) - c->cx);
+        model.line[c->cy][c->cx] = '\0';
+        for(int q=0;q<k;q++){
+            struct cursor *o = &checkCursors[q];
+            if(o->cy == c->cy){
+                o->cy++;
+                o->cx -= c->cx;
+            } else {
+                o->cy++;
+            }
+        }
+        c->cy++;
+        c->cx = 0;
+    } else if(op == 'd'){
+        if(c->cy == model.n || (c->cx == 0 && c->cy == 0)) return;
+        if(c->cx > 0){
+            char *line = model.line[c->cy];
+            int at = c->cx-1;
+            while(at > 0 && utf8IsCont(line[at])) at--;
+            int w = c->cx - at;
+            memmove(&line[at], &line[c->cx], strlen(line) - c->cx + 1);
+            for(int q=0;q<=k;q++){
+                if(checkCursors[q].cy == c->cy) checkCursors[q].cx -= w;
+            }
+            return;
+        }
+        int len = strlen(model.line[c->cy-1]);
+        model.line[c->cy-1] = realloc(model.line[c->cy-1], len + strlen(model.line[c->cy]) + 1);
+        strcat(model.line[c->cy-1], model.line[c->cy]);
+        checkModelDelete(c->cy);
+        int cy = c->cy;
+        for(int q=0;q<=k;q++){
+            struct cursor *o = &checkCursors[q];
+            if(o->cy == cy){
+                o->cy--;
+                o->cx += len;
+            } else {
+                o->cy--;
+            }
+        }
+    } else {
+        if(c->cy == model.n) checkModelInsert(model.n, "", 0);
+        char *line = model.line[c->cy] = realloc(model.line[c->cy], strlen(model.line[c->cy]) + 2);
+        memmove(&line[c->cx+1], &line[c->cx], strlen(line) - c->cx + 1);
+        line[c->cx] = op;
+        for(int q=0;q<=k;q++){
+            if(checkCursors[q].cy == c->cy) checkCursors[q].cx++;
+        }
+    }
+}
+
+//an edit with many cursors leaves the text and the cursors where doing it one cursor at a time from the bottom does
+void checkCursorEdits(){
+    checkRandomModel(120);
+    checkOpen();
+    for(int round=0;round<2000;round++){
+        int op = "ndx"[checkRand(3)], n = 1 + checkRand(8);
+        checkNCursors = 0;
+        for(int j=0;j<n;j++){
+            struct cursor *c = &checkCursors[checkNCursors++];
+            c->cy = checkRand(8) == 0 ? model.n : checkRand(model.n + 1);
+            c->cy = c->cy - c->cy % (1 + checkRand(3)); //runs of rows and rows with several cursors come up often
+            int len = c->cy < model.n ? (int)strlen(model.line[c->cy]) : 0;
+            c->cx = checkRand(4) == 0 ? 0 : checkRand(len+1);
+            while(c->cx > 0 && c->cx < len && utf8IsCont(model.line[c->cy][c->cx])) c->cx--;
+            c->flags = 0;
+        }
+        checkModelDedupe();
+
+        E.cursors.count = 0;
+        E.cy = checkCursors[0].cy;
+        E.cx = checkCursors[0].cx;
+        for(int j=1;j<checkNCursors;j++) editorCursorsAdd(checkCursors[j].cy, checkCursors[j].cx);
+        if(op == 'n') editorCursorsNewLine();
+        else if(op == 'd') editorCursorsDelChar();
+        else editorCursorsInsertChar(op);
+
+        qsort(checkCursors, checkNCursors, sizeof(struct cursor), checkCursorDesc);
+        for(int k=0;k<checkNCursors;k++) checkModelEdit(op, k);
+        checkModelDedupe();
+
+        checkText();
+        struct cursor got[17];
+        int ngot = 0;
+        got[ngot].cx = E.cx;
+        got[ngot++].cy = E.cy;
+        for(int j=0;j<E.cursors.count && ngot<17;j++) got[ngot++] = E.cursors.all[j];
+        qsort(got, ngot, sizeof(struct cursor), editorCursorCmp);
+        CHECK(ngot == checkNCursors);
+        for(int j=0;j<ngot && j<checkNCursors;j++) CHECK(got[j].cy == checkCursors[j].cy && got[j].cx == checkCursors[j].cx);
+        if(round % 8 == 0) checkAll();
+        if(model.n > 400 || model.n < 20){
+            checkRandomModel(120);
+            checkOpen();
+        }
+    }
+    E.cursors.count = 0;
+    checkAll();
+}
+
+//the symbol prompt ranks what scoring every definition would, however the candidates were narrowed
+void checkRankAgainstAll(char *query){
+    editorSymbolRank(query);
+    struct symbolSearch *s = &symbolSearch;
+    struct symbolIndex *ix = &E.symbols;
+    int qlen = strlen(query);
+    if(qlen == 0 || qlen > 64){
+        CHECK(s->nbest == 0);
+        return;
+    }
+    char lower[65];
+    for(int j=0;j<=qlen;j++) lower[j] = tolower((unsigned char)query[j]);
+    struct symbolMatch *all = malloc(sizeof(struct symbolMatch) * (ix->count + 1));
+    int n = 0;
+    for(int i=0;i<ix->count;i++){
+        struct symbolRef *r = symbolIndexAt(i);
+        uint64_t starts, pm[64];
+        char *name = &ix->names[r->name];
+        int len = symbolNameLen(r->name);
+        memcpy(&starts, name, sizeof(starts));
+        editorSymbolPositions(name + SYMBOL_NAME_HEADER, len, lower, qlen, pm);
+        int score = editorSymbolScore(pm, qlen, starts, len);
+        if(score < 0) continue;
+        all[n].score = score;
+        all[n].row = r->row;
+        all[n++].sym = NULL;
+    }
+    qsort(all, n, sizeof(struct symbolMatch), editorSymbolMatchCmp);
+    if(n > QUILLO_SYMBOL_RESULTS) n = QUILLO_SYMBOL_RESULTS;
+    CHECK(s->nbest == n);
+    for(int j=0;j<n && j<s->nbest;j++){
+        CHECK(s->best[j].score == all[j].score && s->best[j].row == all[j].row);
+        CHECK(s->best[j].sym == E.row[all[j].row].sym);
+    }
+    free(all);
+}
+
+void checkSymbols(){
+    char *parts[] = { "editor", "Open", "row", "Rows", "_index", "Find", "buf", "2", "Ex", "search", "o", "e" };
+    while(model.n) checkModelDelete(model.n-1);
+    checkModelInsert(0, "void editorOpen(char *filename){", 32);
+    checkModelInsert(1, "}", 1);
+    for(int j=2;j<3000;j++){
+        char buf[128];
+        int len = snprintf(buf, sizeof(buf), "int ");
+        for(int k=1+checkRand(4);k>0;k--) len += snprintf(&buf[len], sizeof(buf) - len, "%s", parts[checkRand(12)]);
+        len += snprintf(&buf[len], sizeof(buf) - len, "%d(void){", j);
+        checkModelInsert(j, buf, len);
+    }
+    checkOpen();
+    checkAll();
+
+    editorSymbolRank("editorOpen");
+    CHECK(symbolSearch.nbest > 0 && symbolSearch.best[0].row == 0);
+
+    //growing a query narrows from the earlier candidates, an empty query in between must not lose them
+    char *queries[] = { "e", "ed", "edo", "edop", "", "e", "eo", "eor", "ro", "", "", "x", "xs", "searcho", "f2", "EDITOROPEN" };
+    for(unsigned j=0;j<sizeof(queries) / sizeof(queries[0]);j++) checkRankAgainstAll(queries[j]);
+
+    //an edit between two searches, matches keep their symbols alive while the rows lose them
+    checkRankAgainstAll("rows");
+    editorDelRows(0, 200);
+    for(int j=0;j<200;j++) checkModelDelete(0);
+    for(int j=0;j<symbolSearch.nbest;j++) CHECK(symbolSearch.best[j].sym->refs > 0 && symbolSearch.best[j].sym->len > 0);
+    checkRankAgainstAll("rowsf");
+    checkRankAgainstAll("rows");
+    editorSymbolForget();
+    checkAll();
+}
+
+//soft wrapped lines of wide characters start on a character and fit the screen
+void checkWrap(){
+    while(model.n) checkModelDelete(model.n-1);
+    char buf[512];
+    int len = 0;
+    for(int j=0;j<101;j++) len += snprintf(&buf[len], sizeof(buf) - len, j % 7 == 3 ? "a" : "\xe4\xb8\xad");
+    checkModelInsert(0, buf, len);
+    checkOpen();
+    erow *row = &E.row[0];
+    char *starts = calloc(row->rcols + 1, 1); //columns a character starts on
+    for(int at=0, col=0, w;at<row->rsize;col += w){
+        at += utf8RenderChar(&row->render[at], row->rsize - at, &w);
+        starts[col] = 1;
+    }
+    for(int cols=3;cols<=41;cols++){
+        E.screencols = cols;
+        int lines = editorWrapLines(row), total = 0;
+        for(int sub=0;sub<lines;sub++){
+            int start = editorWrapStart(row, sub);
+            int end = sub+1 < lines ? editorWrapStart(row, sub+1) : row->rcols;
+            CHECK(end - start <= cols && end > start);
+            CHECK(starts[start]);
+            int at;
+            CHECK(editorWrapSub(row, start, &at) == sub && at == start);
+            total += end - start;
+        }
+        CHECK(total == row->rcols);
+    }
+    free(starts);
+    E.screencols = 40;
+}
+
+static int checkWeighed;
+
+int64_t checkWrapWeight(erow *row){
+    checkWeighed++;
+    return editorWrapLines(row);
+}
+
+//inserting and deleting rows only weighs the rows from the edit on again, and those from their kept counts
+void checkWrapIndex(){
+    checkRandomModel(2000);
+    checkOpen();
+    E.wrap.weight = checkWrapWeight;
+    for(int round=0;round<50;round++){
+        int at = checkRand(model.n);
+        if(round % 2){
+            checkModelDelete(at);
+            editorDelRow(at);
+        } else {
+            checkModelInsert(at, "int inserted(void){ return 0; } /* long enough to wrap at forty columns */", 74);
+            editorInsertRow(at, model.line[at], 74);
+        }
+        checkWeighed = 0;
+        int loaded = 0;
+        for(int j=0;j<E.numrows;j++) loaded += E.row[j].wraps == 0;
+        editorWrapEnsure();
+        CHECK(checkWeighed == E.numrows - at);
+        for(int j=0;j<E.numrows;j++) loaded -= E.row[j].wraps == 0;
+        CHECK(loaded == 1 - round % 2); //only an inserted row had to be counted from its text
+        checkIndexes();
+    }
+    E.wrap.weight = editorWrapLines;
+    checkAll();
+}
+
+//opening and closing folds weighs rows again only from the first outermost fold that changed, moving rows past folds leaves them be
+void checkFoldWrap(){
+    checkRandomModel(600);
+    checkOpen();
+    E.wrap.weight = checkWrapWeight;
+    E.folds.cap = 8;
+    E.folds.all = malloc(sizeof(struct fold) * E.folds.cap);
+    for(int round=0;round<100;round++){
+        int first = INT_MAX;
+        if(round % 3 == 2){ //rows moving below every fold
+            int at = 500 + checkRand(50);
+            checkModelInsert(at, "x", 1);
+            editorInsertRow(at, "x", 1);
+            first = at;
+        } else {
+            struct fold f = { checkRand(400), 0 };
+            f.end = f.start + 1 + checkRand(40);
+            int j = 0;
+            while(j < E.folds.count && E.folds.all[j].start <= f.start) j++;
+            if(E.folds.count == E.folds.cap || round % 3 == 1){ //open one instead
+                if(E.folds.count == 0) continue;
+                j = checkRand(E.folds.count);
+                first = E.folds.all[j].start+1;
+                E.folds.count--;
+                memmove(&E.folds.all[j], &E.folds.all[j+1], sizeof(struct fold) * (E.folds.count - j));
+            } else {
+                memmove(&E.folds.all[j+1], &E.folds.all[j], sizeof(struct fold) * (E.folds.count - j));
+                E.folds.all[j] = f;
+                E.folds.count++;
+                first = f.start+1;
+            }
+            editorFoldUpdateTop();
+        }
+        checkWeighed = 0;
+        editorWrapEnsure();
+        CHECK(checkWeighed <= E.numrows - first);
+        checkIndexes();
+    }
+    E.wrap.weight = editorWrapLines;
+    E.folds.count = 0;
+    editorFoldUpdateTop();
+    checkAll();
+}
+
+//highlighting on several threads leaves every row as a pass from the top does, comments across chunks included
+void checkParallelHighlight(){
+    checkRandomModel(3001);
+    free(model.line[740]);
+    model.line[740] = strdup("/* a comment running over a chunk boundary");
+    for(int j=741;j<1700;j++){
+        if(strstr(model.line[j], "*/")) model.line[j][0] = '\0';
+    }
+    checkOpen();
+    unsigned char **hl = malloc(sizeof(*hl) * E.numrows);
+    int *open = malloc(sizeof(int) * E.numrows);
+    for(int j=0;j<E.numrows;j++){
+        hl[j] = malloc(E.row[j].rsize + 1);
+        memcpy(hl[j], E.row[j].hl, E.row[j].rsize);
+        open[j] = E.row[j].hlOpenComment;
+    }
+    CHECK(open[1000]); //the case that needs the fix-up is really there
+    for(int nthreads=1;nthreads<=7;nthreads++){
+        editorHighlightParallel(nthreads);
+        for(int j=0;j<E.numrows;j++){
+            CHECK(!memcmp(E.row[j].hl, hl[j], E.row[j].rsize));
+            CHECK(E.row[j].hlOpenComment == open[j]);
+        }
+        checkIndexes();
+    }
+    for(int j=0;j<E.numrows;j++) free(hl[j]);
+    free(hl);
+    free(open);
+}
+
+//text of row at as it reads now, loading it from wherever it lives
+int checkRowIs(int at, const char *text){
+    editorRowChars(&E.row[at]);
+    return E.row[at].size == (int)strlen(text) && !memcmp(E.row[at].chars, text, E.row[at].size);
+}
+
+//a file opened from its sidecar stays mapped, saving over it has to leave the rows still on the file readable
+void checkSidecarSave(){
+    char dir[] = "/tmp/quillo-check-XXXXXX";
+    if(mkdtemp(dir) == NULL){
+        CHECK(!"mkdtemp");
+        return;
+    }
+    char path[64], cache[64];
+    snprintf(path, sizeof(path), "%s/big.txt", dir);
+    snprintf(cache, sizeof(cache), "%s/cache", dir);
+    while(model.n) checkModelDelete(model.n-1);
+    FILE *fp = fopen(path, "w");
+    for(int j=0;j<60000;j++){
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "line %d", j);
+        checkModelInsert(j, buf, len);
+        fprintf(fp, "%s\n", buf);
+    }
+    fclose(fp);
+
+    editorBufferFree();
+    E.cachedir = cache;
+    CHECK(editorOpen(path) == 0 && E.map == NULL);
+    editorIndexSave();
+    editorBufferFree();
+    CHECK(editorOpen(path) == 0 && E.map != NULL); //rows come from the sidecar and the mapped file
+
+    //grow the file, rows never loaded are read after the save
+    for(int j=0;j<3;j++) editorRowInsertChar(&E.row[0], 0, 'x');
+    model.line[0] = realloc(model.line[0], strlen(model.line[0]) + 4);
+    memmove(model.line[0] + 3, model.line[0], strlen(model.line[0]) + 1);
+    memcpy(model.line[0], "xxx", 3);
+    editorSave();
+    CHECK(E.dirty == 0);
+    CHECK(checkRowIs(50000, "line 50000"));
+
+    //shrink it, rows past the new end of the old mapping must not be read from there
+    editorDelRows(100, 50000);
+    for(int j=0;j<50000;j++) checkModelDelete(100);
+    editorSave();
+    CHECK(checkRowIs(E.numrows-1, "line 59999"));
+    checkText();
+
+    //what is on disk is the rows, both read line by line and through a sidecar written for it
+    editorBufferFree();
+    CHECK(editorOpen(path) == 0 && E.map == NULL);
+    checkText();
+    editorIndexSave();
+    editorBufferFree();
+    CHECK(editorOpen(path) == 0 && E.map != NULL);
+    checkText();
+
+    char *sidecar = editorIndexPath();
+    if(sidecar) unlink(sidecar);
+    free(sidecar);
+    editorBufferFree();
+    E.cachedir = NULL;
+    unlink(path);
+    rmdir(cache);
+    rmdir(dir);
+}
+
+//byte offsets of rows follow the file, \r\n and a last line without a newline included, opened either way
+void checkCrlf(){
+    char dir[] = "/tmp/quillo-check-XXXXXX";
+    if(mkdtemp(dir) == NULL){
+        CHECK(!"mkdtemp");
+        return;
+    }
+    char path[64], cache[64];
+    snprintf(path, sizeof(path), "%s/crlf.txt", dir);
+    snprintf(cache, sizeof(cache), "%s/cache", dir);
+    const char *text = "a\r\nbb\r\n\r\nccc\nd\r\r\nlast";
+    int64_t starts[] = { 0, 3, 7, 9, 13, 17, 21 };
+    FILE *fp = fopen(path, "w");
+    fputs(text, fp);
+    fclose(fp);
+
+    editorBufferFree();
+    E.cachedir = cache;
+    for(int pass=0;pass<2;pass++){ //read line by line, then from the sidecar the first pass left
+        CHECK(editorOpen(path) == 0);
+        CHECK(E.numrows == 6 && (E.map != NULL) == pass);
+        for(int j=0;j<=E.numrows && j<=6;j++){
+            CHECK(editorRowOffset(j) == starts[j]);
+            int row;
+            int64_t rem;
+            rowIndexFind(&E.bytes, starts[j] + (j < 6), &row, &rem);
+            CHECK(row == j && rem == (j < 6));
+        }
+        editorIndexSave();
+        editorBufferFree();
+    }
+
+    //a save writes every line with a \n, the offsets go along
+    CHECK(editorOpen(path) == 0);
+    editorSave();
+    CHECK(editorRowOffset(E.numrows) == (int64_t)strlen("a\nbb\n\nccc\nd\nlast\n"));
+
+    char *sidecar = editorIndexPath();
+    if(sidecar) unlink(sidecar);
+    free(sidecar);
+    editorBufferFree();
+    E.cachedir = NULL;
+    unlink(path);
+    rmdir(cache);
+    rmdir(dir);
+}
+
+//pasted whole lines borrow their chars and are not taken for ascii when they are not
+void checkPaste(){
+    checkRandomModel(100);
+    for(int j=12;j<30;j += 6){
+        checkModelDelete(j);
+        checkModelInsert(j, "\xe4\xb8\xad = 1;", 7);
+    }
+    checkOpen();
+    E.sel.active = 1;
+    E.sel.cy = 10;
+    E.sel.cx = 0;
+    E.cy = 30;
+    E.cx = 0;
+    editorClipboardCopy(0);
+    E.cy = 50;
+    E.cx = 0;
+    editorClipboardPaste();
+    for(int j=0;j<20;j++) checkModelInsert(50+j, model.line[10+j], strlen(model.line[10+j]));
+    for(int j=0;j<E.numrows;j++){
+        editorRowChars(&E.row[j]);
+        CHECK(E.row[j].ascii == utf8IsAscii(E.row[j].chars, E.row[j].size));
+    }
+    checkAll();
+}
+
+//filter output replacing rows keeps its UTF-8 lines from being taken for ascii
+void checkFilterReplace(){
+    checkRandomModel(50);
+    checkOpen();
+    struct filterOutput out = {NULL, NULL, 0, 0, NULL, 0, 0};
+    char *lines[] = { "plain", "\xe6\x96\x87 x", "", "tail \xe4\xb8\xad" };
+    for(int j=0;j<4;j++) editorFilterAddLine(&out, lines[j], strlen(lines[j]));
+    editorFilterReplace(20, 30, &out);
+    editorFilterFree(&out);
+    for(int j=29;j>=20;j--) checkModelDelete(j);
+    for(int j=0;j<4;j++) checkModelInsert(20+j, lines[j], strlen(lines[j]));
+    for(int j=20;j<24;j++) CHECK(E.row[j].ascii == utf8IsAscii(E.row[j].chars, E.row[j].size));
+    checkAll();
+}
+
+pid_t checkSpawn(char *cmd){
+    pid_t pid = fork();
+    if(pid == 0){
+        setpgid(0, 0);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+//a filter command that exits is reaped as is, a cancelled one that ignores SIGTERM still gets killed
+void checkFilterWait(){
+    int cancelled = 0;
+    int status = editorFilterWait(checkSpawn("exit 3"), &cancelled);
+    CHECK(!cancelled && WIFEXITED(status) && WEXITSTATUS(status) == 3);
+
+    pid_t pid = checkSpawn("trap '' TERM; echo >/dev/null; sleep 30");
+    struct timespec ts = {0, 200000000}; //give the trap time to go in
+    nanosleep(&ts, NULL);
+    cancelled = 1;
+    uint64_t start = perfNow();
+    status = editorFilterWait(pid, &cancelled);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+    CHECK(perfNow() - start >= QUILLO_FILTER_KILL_NS);
+}
+
+int main(){
+    editorBufferReset();
+    editorInitColors();
+    E.buffers = malloc(sizeof(struct editorBuffer));
+    E.numbuffers = 1;
+    E.screenrows = 24;
+    E.screencols = 40;
+    E.softwrap = 1;
+
+    checkRowEdits();
+    checkRowShift();
+    checkFolds();
+    checkCursorEdits();
+    checkSymbols();
+    checkWrap();
+    checkWrapIndex();
+    checkFoldWrap();
+    checkParallelHighlight();
+    checkSidecarSave();
+    checkCrlf();
+    checkPaste();
+    checkFilterReplace();
+    checkFilterWait();
+
+    if(failures){
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}